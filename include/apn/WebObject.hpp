@@ -203,6 +203,22 @@ public:
 	void SetContentType(std::string val) {
 		fContentType = val ;
 	}
+
+	/**
+	 * SetRespHeader: function to add a response header
+	 *
+	 * @param h
+	 *   String header name
+	 *
+	 * @param v
+	 *   String header value
+	 *
+	 * @return
+	 *   none
+	 */
+	void SetRespHeader(std::string h, std::string v) {
+		addHeaders(h,v,respHeaders);
+	}
 	/**
 	 * GetContentType: function to get URL ContentType
 	 *
@@ -0,0 +1,565 @@
+/**
+* @project dishante
+* @file include/dsh/AttrStore.hpp
+* @author  S Roychowdhury <sroycode AT gmail DOT com>
+* @version 1.0
+*
+* @section LICENSE
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details at
+* http://www.gnu.org/copyleft/gpl.html
+*
+* @section DESCRIPTION
+*
+* AttrStore keeps the attributes of the points of an index by column.  The strings of
+* a field are packed one after the other into a char arena, and each point has one
+* 64 bit word per field holding the position and length of its string, so a point
+* costs 8 bytes per field besides its characters.  A row read from it is a view that
+* points into the arena, nothing is copied till it is written out.
+*
+* The arena and the words are kept in segments that double in size and never move,
+* so a row may be read while points are being appended, rows once added do not change.
+* Deleted points are dropped by copying the others to a new store, a row shares the
+* columns it was read from so that it stays valid after the store is replaced.
+*
+* With a dictionary size a field of few distinct values keeps each value once and a
+* 1 or 2 byte code per point, a field found to have more while loading is stored plain.
+*
+* A search may be restricted to the points whose fields have given values, an attr_where.
+* The store matches a point against it by comparing codes on a dictionary column, the
+* values are looked up once per search, and strings only on a plain one.
+*
+* attr_store picks the store PointData keeps its attributes in, an AttrStore for
+* std::vector<std::string> and an AttrDeque of copies for any other type.
+*
+*/
+
+#ifndef _DSH_ATTR_STORE_HPP_
+#define _DSH_ATTR_STORE_HPP_
+#define DSH_ATTR_STORE_HPP_PROGNO 1115
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <apn/Exception.hh>
+
+namespace dsh {
+/**
+* attr_where : conditions on the fields of a point, each the no of a field and the values
+* it may have, a point matches if it meets all of them
+*/
+typedef std::vector<std::pair<std::size_t, std::vector<std::string> > > attr_where;
+
+/**
+* attr_segments : append only array in segments of 2^B, 2^(B+1), .. elements, elements
+* never move and a segment is only allocated when first used
+*/
+template <class T, unsigned int B>
+class attr_segments : private boost::noncopyable {
+public:
+	attr_segments() {
+		std::fill(seg, seg+Segs, (T*)0);
+	}
+	~attr_segments() {
+		clear();
+	}
+
+	/**
+	* clear : free all segments
+	*/
+	void clear() {
+		for (unsigned int k=0; k<Segs; ++k) {
+			delete [] seg[k];
+			seg[k]=0;
+		}
+	}
+
+	/**
+	* at : element i, its segment must exist
+	*/
+	T& at(long unsigned int i) const {
+		unsigned int k;
+		long unsigned int o;
+		Locate(i, k, o);
+		return seg[k][o];
+	}
+
+	/**
+	* make : pointer to elements i .. i+n-1 if they are in one segment, allocating it,
+	* 0 if they are not
+	*/
+	T* make(long unsigned int i, long unsigned int n) {
+		unsigned int k;
+		long unsigned int o;
+		Locate(i, k, o);
+		if (o+n > Size(k)) return 0;
+		if (!seg[k]) seg[k] = new T[Size(k)];
+		return seg[k]+o;
+	}
+
+	/**
+	* next : index of the first element of the segment after that of element i
+	*/
+	static long unsigned int next(long unsigned int i) {
+		unsigned int k;
+		long unsigned int o;
+		Locate(i, k, o);
+		return i - o + Size(k);
+	}
+
+private:
+	static const unsigned int Segs = sizeof(long unsigned int)*8 - B;
+	T* seg[Segs];
+
+	static long unsigned int Size(unsigned int k) {
+		return 1UL << (B+k);
+	}
+
+	/**
+	* Locate : segment k and offset o of element i, i+2^B has its top bit at B+k
+	*/
+	static void Locate(long unsigned int i, unsigned int& k, long unsigned int& o) {
+		long unsigned int j = i + (1UL << B);
+#ifdef __GNUC__
+		unsigned int top = sizeof(long unsigned int)*8 - 1 - __builtin_clzl(j);
+#else
+		unsigned int top = B;
+		while (j >> (top+1)) ++top;
+#endif
+		k = top - B;
+		o = j - (1UL << top);
+	}
+};
+
+class AttrStore : private boost::noncopyable {
+	class Column;
+public:
+	typedef std::vector<std::string> value_type;
+
+	/**
+	* Field : view of one string of the store
+	*/
+	class Field {
+	public:
+		Field(const char* p=0, std::size_t n=0) : p_(p), n_(n) {}
+		const char* data() const {
+			return p_;
+		}
+		std::size_t size() const {
+			return n_;
+		}
+		std::string str() const {
+			return std::string(p_, n_);
+		}
+		bool operator==(const std::string& s) const {
+			return s.size()==n_ && (n_==0 || std::memcmp(p_, s.data(), n_)==0);
+		}
+		bool operator!=(const std::string& s) const {
+			return !(*this==s);
+		}
+		friend std::ostream& operator<<(std::ostream& os, const Field& f) {
+			return os.write(f.p_, f.n_);
+		}
+	private:
+		const char* p_;
+		std::size_t n_;
+	};
+
+	typedef boost::shared_ptr<Column> ColumnP;
+	typedef boost::shared_ptr<std::vector<ColumnP> > ColumnsP;
+
+	/**
+	* Row : view of the fields of one point, it keeps the columns it points into
+	*/
+	class Row {
+	public:
+		Row() : id_(0) {}
+		Row(const ColumnsP& c, long unsigned int id) : c_(c), id_(id) {}
+		std::size_t size() const {
+			return c_ ? c_->size() : 0;
+		}
+		Field operator[](std::size_t j) const {
+			return (*c_)[j]->Get(id_);
+		}
+		bool empty() const {
+			return size()==0;
+		}
+	private:
+		ColumnsP c_;
+		long unsigned int id_;
+	};
+	typedef Row row_type;
+
+	/**
+	* Match : matches the points of the store against an attr_where, valid while the
+	* store is and no point is added to it
+	*/
+	class Match {
+	public:
+		Match(const AttrStore& s, const attr_where& w) {
+			for (std::size_t k=0; k<w.size(); ++k) {
+				Cond c;
+				c.Col = (w[k].first < s.Columns->size()) ? (*s.Columns)[w[k].first].get() : 0;
+				c.Values = &w[k].second;
+				if (c.Col) c.Col->Codes(*c.Values, c.Codes);
+				Conds.push_back(c);
+			}
+		}
+		bool operator()(long unsigned int id) const {
+			for (std::size_t k=0; k<Conds.size(); ++k) {
+				const Cond& c = Conds[k];
+				if (!(c.Col ? c.Col->Test(id, c.Codes, *c.Values) : Column::Has(Field(), *c.Values))) return false;
+			}
+			return true;
+		}
+	private:
+		struct Cond {
+			const Column* Col; // 0 if the store has no such field, it is then empty
+			const std::vector<std::string>* Values;
+			std::vector<bool> Codes; // by code, true for the codes of the values
+		};
+		std::vector<Cond> Conds;
+	};
+
+	/**
+	* Constructor
+	*
+	* @param dict
+	*   unsigned int max no of distinct values of a dictionary column, 0 for none
+	*
+	*/
+	AttrStore(unsigned int dict=0) : Columns(new std::vector<ColumnP>), Size(0), DictSize(dict), Frozen(false) {}
+
+	/**
+	* push_back : add the fields of the next point, the first point fixes the no of fields
+	*
+	* @param a
+	*   value_type fields
+	*
+	* @return
+	*   none
+	*/
+	void push_back(const value_type& a) {
+		if (Size==0 && Columns->empty()) {
+			for (std::size_t j=0; j<a.size(); ++j) Columns->push_back(ColumnP(new Column(DictSize)));
+		}
+		if (a.size() > Columns->size())
+			throw apn::GenericException(DSH_ATTR_STORE_HPP_PROGNO,"too many fields"," for the store");
+		for (std::size_t j=0; j<Columns->size(); ++j) {
+			(*Columns)[j]->Append(Size, (j<a.size()) ? a[j] : std::string());
+		}
+		++Size;
+	}
+
+	/**
+	* append : add the fields of points of another store, in the order given
+	*
+	* @param s
+	*   AttrStore store to copy from
+	*
+	* @param ids
+	*   std::vector<long unsigned int> ids in s of the points to add
+	*
+	* @return
+	*   none
+	*/
+	template <class V>
+	void append(const AttrStore& s, const V& ids) {
+		if (Size==0 && Columns->empty()) {
+			for (std::size_t j=0; j<s.Columns->size(); ++j) Columns->push_back(ColumnP(new Column(DictSize)));
+		}
+		if (s.Columns->size() != Columns->size())
+			throw apn::GenericException(DSH_ATTR_STORE_HPP_PROGNO,"other fields"," for the store");
+		for (std::size_t i=0; i<ids.size(); ++i) {
+			for (std::size_t j=0; j<Columns->size(); ++j) {
+				Field f = (*s.Columns)[j]->Get(ids[i]);
+				(*Columns)[j]->Append(Size, f.data(), f.size());
+			}
+			++Size;
+		}
+	}
+
+	/**
+	* operator[] : the fields of point id
+	*/
+	row_type operator[](std::size_t id) const {
+		return Row(Columns, id);
+	}
+
+	std::size_t size() const {
+		return Size;
+	}
+
+	/**
+	* permute : rebuild the store with point i taking the fields of point order[i]
+	*
+	* @param order
+	*   std::vector<long unsigned int> old id of each new id
+	*
+	* @return
+	*   none
+	*/
+	template <class V>
+	void permute(const V& order) {
+		AttrStore a(DictSize);
+		a.append(*this, order);
+		if (Frozen) a.freeze();
+		swap(a);
+	}
+
+	/**
+	* freeze : fix the layout of the columns before rows are read while others are added,
+	* dictionary columns take 1 byte codes if they have few values
+	*/
+	void freeze() {
+		for (std::size_t j=0; j<Columns->size(); ++j) (*Columns)[j]->Freeze(Size);
+		Frozen=true;
+	}
+
+	void swap(AttrStore& other) {
+		Columns.swap(other.Columns);
+		std::swap(Size, other.Size);
+		std::swap(DictSize, other.DictSize);
+		std::swap(Frozen, other.Frozen);
+	}
+
+private:
+	/**
+	* Strings : strings by number, the word of a string is its position in the arena
+	* shifted left by LenBits, ORed with its length
+	*/
+	class Strings : private boost::noncopyable {
+	public:
+		Strings() : End(0) {}
+
+		void Put(long unsigned int i, const char* p, std::size_t n) {
+			if (n >= (1UL << LenBits))
+				throw apn::GenericException(DSH_ATTR_STORE_HPP_PROGNO,"field too long"," for the store");
+			/** a string is kept whole in one segment, it skips the rest of one it does not fit */
+			char* at = 0;
+			while (n>0 && !(at = Chars.make(End, n))) End = Chars.next(End);
+			if (n>0) std::memcpy(at, p, n);
+			*Words.make(i, 1) = (End << LenBits) | n;
+			End += n;
+		}
+		Field Get(long unsigned int i) const {
+			long unsigned int w = Words.at(i);
+			long unsigned int n = w & ((1UL << LenBits) - 1);
+			return (n==0) ? Field() : Field(&Chars.at(w >> LenBits), n);
+		}
+		void clear() {
+			Words.clear();
+			Chars.clear();
+			End=0;
+		}
+	private:
+		static const unsigned int LenBits = 24;
+		attr_segments<long unsigned int, 10> Words;
+		attr_segments<char, 16> Chars;
+		long unsigned int End;
+	};
+
+	/**
+	* Column : strings of one field.  A dictionary column keeps each distinct value once
+	* and a code per point, 2 bytes while loading and 1 once frozen if the values fit.
+	* Loading more values than the dictionary takes turns it into a plain column, once
+	* frozen the points with new values get the Spill code and are kept as plain strings.
+	*/
+	class Column : private boost::noncopyable {
+	public:
+		Column(unsigned int dict) : Width((dict>0) ? 2 : 0), Dict((dict<Spill16) ? dict : Spill16), Frozen(false) {}
+
+		void Append(long unsigned int id, const std::string& s) {
+			Append(id, s.data(), s.size());
+		}
+		void Append(long unsigned int id, const char* p, std::size_t n) {
+			if (Width==0) {
+				Plain.Put(id, p, n);
+				return;
+			}
+			std::string v(p, n);
+			std::map<std::string,unsigned int>::const_iterator it = Lookup.find(v);
+			unsigned int c = Spill();
+			if (it!=Lookup.end()) c = it->second;
+			else if (Lookup.size() < Dict && Lookup.size() < Spill()) {
+				c = Lookup.size();
+				Values.Put(c, p, n);
+				Lookup.insert(std::make_pair(v, c));
+			} else if (!Frozen) {
+				ToPlain(id);
+				Plain.Put(id, p, n);
+				return;
+			}
+			if (c==Spill()) Plain.Put(id, p, n);
+			if (Width==1) *Codes8.make(id, 1) = (unsigned char) c;
+			else *Codes16.make(id, 1) = (unsigned short) c;
+		}
+		Field Get(long unsigned int id) const {
+			if (Width==0) return Plain.Get(id);
+			unsigned int c = (Width==1) ? Codes8.at(id) : Codes16.at(id);
+			return (c==Spill()) ? Plain.Get(id) : Values.Get(c);
+		}
+		void Freeze(long unsigned int size) {
+			if (Width==2 && Lookup.size() < Spill8) {
+				for (long unsigned int i=0; i<size; ++i) *Codes8.make(i, 1) = (unsigned char) Codes16.at(i);
+				Codes16.clear();
+				Width=1;
+			}
+			Frozen=true;
+		}
+
+		/**
+		* Codes : ok by code, true for the codes of the values, empty for a plain column
+		*/
+		void Codes(const std::vector<std::string>& v, std::vector<bool>& ok) const {
+			ok.clear();
+			if (Width==0) return;
+			ok.assign(Spill()+1, false);
+			for (std::size_t k=0; k<v.size(); ++k) {
+				std::map<std::string,unsigned int>::const_iterator it = Lookup.find(v[k]);
+				if (it!=Lookup.end()) ok[it->second]=true;
+			}
+		}
+		/**
+		* Test : true if point id has one of the values v, ok their codes as by Codes
+		*/
+		bool Test(long unsigned int id, const std::vector<bool>& ok, const std::vector<std::string>& v) const {
+			if (Width==0) return Has(Plain.Get(id), v);
+			unsigned int c = (Width==1) ? Codes8.at(id) : Codes16.at(id);
+			return (c==Spill()) ? Has(Plain.Get(id), v) : ok[c];
+		}
+		static bool Has(const Field& f, const std::vector<std::string>& v) {
+			for (std::size_t k=0; k<v.size(); ++k) {
+				if (f==v[k]) return true;
+			}
+			return false;
+		}
+
+		unsigned int Width; // bytes per code, 0 for a plain column
+	private:
+		static const unsigned int Spill8 = 0xff;
+		static const unsigned int Spill16 = 0xffff;
+		unsigned int Dict;
+		bool Frozen;
+		Strings Plain; // by id
+		Strings Values; // by code
+		std::map<std::string,unsigned int> Lookup;
+		attr_segments<unsigned char, 12> Codes8;
+		attr_segments<unsigned short, 11> Codes16;
+
+		unsigned int Spill() const {
+			return (Width==1) ? Spill8 : Spill16;
+		}
+
+		/**
+		* ToPlain : the points before id as plain strings, only while loading
+		*/
+		void ToPlain(long unsigned int id) {
+			for (long unsigned int i=0; i<id; ++i) {
+				Field f = Values.Get(Codes16.at(i));
+				Plain.Put(i, f.data(), f.size());
+			}
+			Codes16.clear();
+			Values.clear();
+			Lookup.clear();
+			Width=0;
+		}
+	};
+
+	ColumnsP Columns;
+	std::size_t Size;
+	unsigned int DictSize;
+	bool Frozen;
+};
+
+/**
+* AttrDeque : store of copies of the attributes of each point
+*/
+template <class AttrT>
+class AttrDeque {
+public:
+	typedef AttrT value_type;
+	typedef AttrT row_type;
+
+	/**
+	* Match : matches the points against an attr_where by comparing their fields
+	*/
+	class Match {
+	public:
+		Match(const AttrDeque& s, const attr_where& w) : s_(s), w_(w) {}
+		bool operator()(long unsigned int id) const {
+			const AttrT& a = s_[std::size_t(id)];
+			for (std::size_t k=0; k<w_.size(); ++k) {
+				std::size_t j = w_[k].first;
+				bool has = false;
+				for (std::size_t i=0; i<w_[k].second.size() && !has; ++i) {
+					has = (j<a.size()) ? (a[j]==w_[k].second[i]) : w_[k].second[i].empty();
+				}
+				if (!has) return false;
+			}
+			return true;
+		}
+	private:
+		const AttrDeque& s_;
+		const attr_where& w_;
+	};
+
+	AttrDeque(unsigned int=0) {}
+
+	void push_back(const AttrT& a) {
+		Attrs.push_back(a);
+	}
+	const AttrT& operator[](std::size_t id) const {
+		return Attrs[id];
+	}
+	std::size_t size() const {
+		return Attrs.size();
+	}
+	template <class V>
+	void append(const AttrDeque& s, const V& ids) {
+		for (std::size_t i=0; i<ids.size(); ++i) {
+			Attrs.push_back(s[std::size_t(ids[i])]);
+		}
+	}
+	/** copied, not swapped, so that what they hold on the heap is allocated in order too */
+	template <class V>
+	void permute(const V& order) {
+		AttrDeque a;
+		a.append(*this, order);
+		Attrs.swap(a.Attrs);
+	}
+	void freeze() {}
+	void swap(AttrDeque& other) {
+		Attrs.swap(other.Attrs);
+	}
+private:
+	std::deque<AttrT> Attrs;
+};
+
+/**
+* attr_store : the store of an attribute type
+*/
+template <class AttrT>
+struct attr_store {
+	typedef AttrDeque<AttrT> type;
+};
+template <>
+struct attr_store<std::vector<std::string> > {
+	typedef AttrStore type;
+};
+} //namespace dsh
+#endif /* _DSH_ATTR_STORE_HPP_ */
@@ -0,0 +1,117 @@
+/**
+* @project dishante
+* @file include/dsh/GeoEcef.hpp
+* @author  S Roychowdhury <sroycode AT gmail DOT com>
+* @version 1.0
+*
+* @section LICENSE
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details at
+* http://www.gnu.org/copyleft/gpl.html
+*
+* @section DESCRIPTION
+*
+* GeoEcef maps latitude and longitude in degrees to integer earth centered
+* coordinates on a sphere of the mean WGS84 radius.  The chord between two
+* points on the sphere grows with the great circle distance between them,
+* so a 3d search on these coordinates finds the nearest points on the
+* sphere, and its distances convert back to great circle metres.
+*
+*/
+
+#ifndef _DSH_GEO_ECEF_HPP_
+#define _DSH_GEO_ECEF_HPP_
+#define DSH_GEO_ECEF_HPP_PROGNO 1113
+
+/** mean radius of the WGS84 ellipsoid in metres */
+#ifndef DSH_GEO_ECEF_RADIUS
+#define DSH_GEO_ECEF_RADIUS 6371008.8
+#endif
+
+/** coordinate units per metre, 100 keeps squared chords exact in a double */
+#ifndef DSH_GEO_ECEF_SCALE
+#define DSH_GEO_ECEF_SCALE 100
+#endif
+
+#include <cmath>
+#include <apn/Exception.hh>
+
+namespace dsh {
+template <class Point>
+class GeoEcef {
+public:
+	/**
+	* FromLatLon: earth centered point of a latitude and longitude
+	*
+	* @param lat
+	*   double latitude in degrees, -90 to 90
+	*
+	* @param lon
+	*   double longitude in degrees, -180 to 180
+	*
+	* @return
+	*   Point x towards 0,0, y towards 0,90 and z towards the north pole
+	*/
+	static Point FromLatLon(double lat, double lon) {
+		if (!(std::fabs(lat)<=90.0))
+			throw apn::GenericException(DSH_GEO_ECEF_HPP_PROGNO,"latitude out of range"," when projecting");
+		if (!(std::fabs(lon)<=180.0))
+			throw apn::GenericException(DSH_GEO_ECEF_HPP_PROGNO,"longitude out of range"," when projecting");
+		const double r = DSH_GEO_ECEF_RADIUS * DSH_GEO_ECEF_SCALE;
+		const double f = Pi() / 180.0;
+		double c = std::cos(lat*f);
+		Point P;
+		P[0] = Round(r * c * std::cos(lon*f));
+		P[1] = Round(r * c * std::sin(lon*f));
+		P[2] = Round(r * std::sin(lat*f));
+		return P;
+	}
+
+	/**
+	* Metres: great circle distance of a chord
+	*
+	* @param chord
+	*   double chord length in coordinate units
+	*
+	* @return
+	*   double distance along the sphere in metres
+	*/
+	static double Metres(double chord) {
+		double h = chord / (2.0 * DSH_GEO_ECEF_RADIUS * DSH_GEO_ECEF_SCALE);
+		return 2.0 * DSH_GEO_ECEF_RADIUS * std::asin((h < 1.0) ? h : 1.0);
+	}
+
+	/**
+	* Chord: chord of a great circle distance, to search a radius with
+	*
+	* @param metres
+	*   double distance along the sphere in metres
+	*
+	* @return
+	*   double chord length in coordinate units, the diameter beyond half the globe
+	*/
+	static double Chord(double metres) {
+		double a = metres / (2.0 * DSH_GEO_ECEF_RADIUS);
+		if (a >= Pi()/2) a = Pi()/2;
+		return 2.0 * DSH_GEO_ECEF_RADIUS * DSH_GEO_ECEF_SCALE * std::sin(a);
+	}
+
+private:
+	static double Pi() {
+		return 3.14159265358979323846;
+	}
+
+	static typename Point::value_type Round(double v) {
+		return typename Point::value_type((v < 0) ? std::ceil(v - 0.5) : std::floor(v + 0.5));
+	}
+};
+} //namespace dsh
+#endif /* _DSH_GEO_ECEF_HPP_ */
@@ -21,6 +21,29 @@
 *
 * PointData type encapsulating the SFC, modified with dim
 *
+* Once locked the SFC is not modified.  If the index allows updates,
+* points inserted later are kept unsorted in a delta buffer searched by
+* brute force beside it, and deleted points are marked dead and skipped.
+* When the delta buffer and the dead points reach the delta option a
+* background thread builds a new SFC from the live points and swaps it
+* in.  Searches take a shared lock, updates take an exclusive lock only
+* to append a point or mark one dead, and the compaction only to swap
+* the new SFC in, so neither waits for a build.  Once locked the SFC
+* holds the only copy of the points, which a compaction reads back.
+* The id of a point is its position in the points the SFC was built
+* from, so a compaction, which builds from the live points only,
+* renumbers the points: an id is only valid till the next Compact.
+* With the permute option the points are numbered in curve order when
+* locked and the attributes are moved to match, so the attributes of
+* the points of one search are read from nearby memory.
+* A search with an attr_where only returns the points whose attributes match it, the
+* SFC search tests a point before it takes it, so the no of results is met exactly.
+* With the level option the index also keeps, for each value of the level field but the
+* highest, an SFC of the points of that level or below, and a search for the points up
+* to a level searches the one of that level, a window search tests the level of each
+* point instead.  Levels are integers, a point whose level field is not one is only found
+* by searches without a level.
+*
 */
 
 #ifndef _DSH_POINT_DATA_HPP_
@@ -29,19 +52,54 @@
 #ifndef DSH_POINT_DATA_MAX_POINTS
 #define DSH_POINT_DATA_MAX_POINTS 10
 #endif
+#ifndef DSH_POINT_DATA_MAX_LEVELS
+#define DSH_POINT_DATA_MAX_LEVELS 16
+#endif
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cctype>
 #include <boost/tuple/tuple.hpp>
 #include <boost/array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
 
 #include <apn/Convert.hpp>
 #include "SfcData.hpp"
+#include "AttrStore.hpp"
 
 
 namespace dsh {
+/**
+* point_options : options of the attributes of the points of an index, those of its
+* SFC are the sfc_options
+*/
+struct point_options {
+	point_options() : dict(0), level(~0U), delta(0) {}
+
+	/** string attribute fields with at most this many distinct values are kept as a
+	    dictionary and a 1 or 2 byte code per point, at most 65534, 0 for none */
+	unsigned int dict;
+
+	/** no of the attribute field holding the integer level of a point, the index then
+	    keeps an index of the points up to each level for searches up to a level, ~0U
+	    for none */
+	unsigned int level;
+
+	/** points inserted or deleted after the index is locked that are kept beside it,
+	    unsorted, before a background compaction folds them into a new index, 0 makes
+	    the index read only once locked */
+	unsigned int delta;
+};
+
 template <class CoordT, class AttrT, unsigned int Dim>
 class PointData : private boost::noncopyable, public boost::enable_shared_from_this<PointData<CoordT,AttrT,Dim> > {
 public:
@@ -49,18 +107,25 @@ public:
 	typedef typename boost::array<CoordT, Dim> Point;
 	typedef typename std::vector<Point> pVec;
 	typedef typename dsh::SfcData<pVec, Dim, CoordT> SfcT;
-	typedef typename boost::tuple<long unsigned int,double,AttrT> OutT;
-	typedef typename std::vector<AttrT> aVec;
+	typedef typename attr_store<AttrT>::type aVec;
+	typedef typename aVec::row_type RowT;
+	typedef typename boost::tuple<long unsigned int,double,RowT> OutT;
 
 
 	/**
 	* create : static construction creates new first time
 	*
+	* @param opts
+	*   sfc_options index build and search options
+	*
+	* @param popts
+	*   point_options options of the attributes
+	*
 	* @return
 	*   none
 	*/
-	static pointer create() {
-		return pointer(new PointData());
+	static pointer create(const sfc_options& opts = sfc_options(), const point_options& popts = point_options()) {
+		return pointer(new PointData(opts, popts));
 	}
 
 	/**
@@ -79,7 +144,7 @@ public:
 	virtual ~PointData() {}
 
 	/**
-	* Add: Add to Array
+	* Add: Add to Array, once locked the point is inserted as by Insert
 	*
 	* @param Q
 	*   Point Q 
@@ -91,9 +156,10 @@ public:
 	*   none
 	*/
 	void Add(Point Q, AttrT a) {
-
-		if (PointDataSize!=0)
-			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize exists"," while addition");
+		if (PointDataSfc) {
+			Insert(Q, a);
+			return;
+		}
 		PointDataVec.push_back(Q);
 		AttrDataVec.push_back(a);
 	}
@@ -105,11 +171,211 @@ public:
 	*   none
 	*/
 	void Lock() {
-		if (PointDataSize!=0)
+		if (PointDataSfc)
 			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize exists"," when locking");
-		PointDataSfc = SfcT(PointDataVec);
+		PointDataSfc = SfcP(new SfcT(PointDataVec, PointDataOpts));
 		PointDataSize=PointDataVec.size();
-		std::cerr << "Loaded 2d " << std::endl;
+		PointDataLive.assign(PointDataSize, true);
+		/** the SFC keeps the points, a compaction reads them back from it */
+		pVec().swap(PointDataVec);
+		if (PointDataOpts.permute) Permute();
+		/** searches read attributes while updates add them from here on */
+		AttrDataVec.freeze();
+		if (HasLevel()) {
+			pVec run;
+			typename SfcT::lVec ids(PointDataSize);
+			std::vector<long> levels(PointDataSize);
+			PointDataLevel.resize(PointDataSize);
+			for (std::size_t i=0; i<PointDataSize; ++i) PointDataLevel[i]=LevelOf(AttrDataVec[i]);
+			PointDataSfc->Points(run);
+			for (std::size_t i=0; i<run.size(); ++i) {
+				ids[i]=i;
+				levels[i]=PointDataLevel[i];
+			}
+			Views(run, ids, levels, PointDataViews, PointDataLevelTop);
+		}
+	}
+
+	/**
+	* Insert: insert a point into a locked index, searches see it at once
+	*
+	* @param Q
+	*   Point Q
+	*
+	* @param a
+	*   AttrT elem a
+	*
+	* @return
+	*   long unsigned int id of the point
+	*/
+	long unsigned int Insert(Point Q, AttrT a) {
+		CheckUpdate(" while insertion");
+		long unsigned int id=0;
+		bool compact=false;
+		{
+			WriteLock wl(PointDataMutex);
+			id=AttrDataVec.size();
+			DeltaVec.push_back(Q);
+			DeltaIds.push_back(id);
+			AttrDataVec.push_back(a);
+			PointDataLive.push_back(true);
+			if (HasLevel()) PointDataLevel.push_back(LevelOf(a));
+			++PointDataSize;
+			compact=StartCompact();
+		}
+		if (compact) boost::thread(boost::bind(&PointData::CompactBackground, share()));
+		return id;
+	}
+
+	/**
+	* Remove: delete a point from a locked index, a compaction renumbers the points so
+	* the id is that of a search or insertion since the last one
+	*
+	* @param id
+	*   long unsigned int id of the point
+	*
+	* @return
+	*   bool false if there is no such live point
+	*/
+	bool Remove(long unsigned int id) {
+		CheckUpdate(" while deletion");
+		bool compact=false;
+		{
+			WriteLock wl(PointDataMutex);
+			if (!Kill(id)) return false;
+			compact=StartCompact();
+		}
+		if (compact) boost::thread(boost::bind(&PointData::CompactBackground, share()));
+		return true;
+	}
+
+	/**
+	* RemoveAt: delete the points at a location whose attributes match
+	*
+	* @param Q
+	*   Point Q
+	*
+	* @param pred
+	*   P predicate called as bool pred(const RowT&), true deletes the point
+	*
+	* @return
+	*   unsigned int no of points deleted
+	*/
+	template<class P>
+	unsigned int RemoveAt(Point Q, P pred) {
+		CheckUpdate(" while deletion");
+		unsigned int n=0;
+		bool compact=false;
+		{
+			/** under one lock, a compaction in between would renumber the points found */
+			WriteLock wl(PointDataMutex);
+			cVec c;
+			Range(Q, 0, 0, c);
+			for (std::size_t i=0; i<c.size(); ++i) {
+				if (pred(AttrDataVec[std::size_t(c[i].second)]) && Kill(c[i].second)) ++n;
+			}
+			if (n>0) compact=StartCompact();
+		}
+		if (compact) boost::thread(boost::bind(&PointData::CompactBackground, share()));
+		return n;
+	}
+
+	/**
+	* Compact : build a new SFC from the live points and swap it in, searches and
+	* updates go on during the build.  The points are renumbered in the order of the
+	* new SFC and their attributes copied to a new store, so that the deleted ones are
+	* freed, rows found before keep the old store till they go.
+	*
+	* @return
+	*   none
+	*/
+	void Compact() {
+		boost::mutex::scoped_lock cl(CompactMutex);
+		if (!PointDataSfc) return;
+		pVec pts, run;
+		typename SfcT::lVec ids;
+		std::vector<long> levels;
+		aVec attrs(PointDataPointOpts.dict);
+		std::size_t ndelta=0;
+		{
+			/** a point is read from the old store while it is appended to, so under the lock */
+			ReadLock rl(PointDataMutex);
+			ndelta=DeltaVec.size();
+			pts.reserve(PointDataSize);
+			ids.reserve(PointDataSize);
+			PointDataSfc->Points(run);
+			for (std::size_t i=0; i<run.size(); ++i) {
+				if (!PointDataLive[i]) continue;
+				pts.push_back(run[i]);
+				ids.push_back(i);
+			}
+			for (std::size_t i=0; i<ndelta; ++i) {
+				long unsigned int id=DeltaIds[i];
+				if (!PointDataLive[id]) continue;
+				pts.push_back(DeltaVec[i]);
+				ids.push_back(id);
+			}
+			if (HasLevel()) {
+				levels.resize(ids.size());
+				for (std::size_t i=0; i<ids.size(); ++i) levels[i]=PointDataLevel[ids[i]];
+			}
+			attrs.append(AttrDataVec, ids);
+		}
+		pVec().swap(run);
+		attrs.freeze();
+		SfcP sfc(new SfcT(pts, PointDataOpts));
+		/** the new id of a point is its position in pts, or in the SFC if permuted */
+		typename SfcT::lVec nids(ids.size()), order;
+		for (std::size_t i=0; i<nids.size(); ++i) nids[i]=i;
+		if (PointDataOpts.permute) {
+			sfc->Renumber(order);
+			for (std::size_t i=0; i<order.size(); ++i) nids[std::size_t(order[i])]=i;
+		}
+		std::vector<LevelView> views;
+		long top=LONG_MIN;
+		if (HasLevel()) Views(pts, nids, levels, views, top);
+		pVec().swap(pts);
+		typename SfcT::lVec().swap(nids);
+		if (PointDataOpts.permute) {
+			/** the old ids and the levels by new id */
+			attrs.permute(order);
+			typename SfcT::lVec o(ids.size());
+			std::vector<long> l(levels.size());
+			for (std::size_t i=0; i<order.size(); ++i) {
+				o[i]=ids[std::size_t(order[i])];
+				if (!l.empty()) l[i]=levels[std::size_t(order[i])];
+			}
+			ids.swap(o);
+			levels.swap(l);
+		}
+		{
+			WriteLock wl(PointDataMutex);
+			/** points inserted during the build follow, those deleted stay dead */
+			typename SfcT::lVec tail(DeltaIds.begin()+ndelta, DeltaIds.end());
+			attrs.append(AttrDataVec, tail);
+			std::vector<bool> live(ids.size()+tail.size());
+			unsigned long int dead=0;
+			for (std::size_t i=0; i<ids.size(); ++i) {
+				live[i]=PointDataLive[ids[i]];
+				if (!live[i]) ++dead;
+			}
+			DeltaVec.erase(DeltaVec.begin(), DeltaVec.begin()+ndelta);
+			DeltaIds.clear();
+			for (std::size_t i=0; i<tail.size(); ++i) {
+				live[ids.size()+i]=PointDataLive[tail[i]];
+				if (!live[ids.size()+i]) ++dead;
+				DeltaIds.push_back(ids.size()+i);
+				if (HasLevel()) levels.push_back(PointDataLevel[tail[i]]);
+			}
+			PointDataSfc.swap(sfc);
+			PointDataViews.swap(views);
+			PointDataLevelTop=top;
+			AttrDataVec.swap(attrs);
+			PointDataLive.swap(live);
+			PointDataLevel.swap(levels);
+			PointDataDead=dead;
+			PointDataCompacting=false;
+		}
 	}
 
 	/**
@@ -121,44 +387,544 @@ public:
 	* @param nores
 	*   unsigned long no of results
 	*
+	* @param budget
+	*   sfc_budget* optional work budget, also returns whether the answer is exact
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points
+	*
+	* @return
+	*   T output point and distance list
+	*/
+	template<class T>
+	T GetNN(Point Q,unsigned int nores, sfc_budget* budget=0, const attr_where* where=0, const long* level=0) {
+		ReadLock rl(PointDataMutex);
+		if (PointDataSize==0)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize is zero"," when searching");
+		CheckLevel(level);
+		cVec c;
+		if (where || level) NearestWhere(Q, nores, c, budget, where, level);
+		else Nearest(Q, nores, c, budget);
+		return Output<T>(c);
+	}
+
+	/**
+	* GetNNBatch: find nearest points for many queries in one sweep
+	*
+	* @param Q
+	*   pVec Query Points
+	*
+	* @param nores
+	*   unsigned long no of results per query
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points
+	*
+	* @return
+	*   std::vector<T> output point and distance list per query, in order of Q
+	*/
+	template<class T>
+	std::vector<T> GetNNBatch(const pVec& Q,unsigned int nores, const attr_where* where=0, const long* level=0) {
+		ReadLock rl(PointDataMutex);
+		if (PointDataSize==0)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize is zero"," when searching");
+		CheckLevel(level);
+		std::vector<T> bout(Q.size());
+		if (where || level || !DeltaVec.empty() || PointDataDead>0) {
+			/** the sweep does not see the updates or filter, search them one by one */
+			cVec c;
+			for (std::size_t q=0; q<Q.size(); ++q) {
+				if (where || level) NearestWhere(Q[q], nores, c, 0, where, level);
+				else Nearest(Q[q], nores, c, 0);
+				bout[q]=Output<T>(c);
+			}
+			return bout;
+		}
+		std::vector<typename SfcT::lVec> answer;
+		std::vector<typename SfcT::dVec> distance;
+		if (nores>PointDataSize) nores=PointDataSize;
+		PointDataSfc->ksearch_batch(Q, (unsigned long)nores, answer,distance,0);
+		for (std::size_t q=0; q<answer.size(); ++q) {
+			for (std::size_t i=0; i<answer[q].size(); ++i) {
+				long unsigned int id=answer[q][i];
+				bout[q].push_back(boost::make_tuple(id,ceil(sqrt(distance[q][i])), AttrDataVec[std::size_t(id)]));
+			}
+		}
+		return bout;
+	}
+
+	/**
+	* GetRange: find points within a radius
+	*
+	* @param Q
+	*   Point Q
+	*
+	* @param radius
+	*   double search radius
+	*
+	* @param nores
+	*   unsigned long max no of results, nearest first, 0 for all
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points
+	*
 	* @return
 	*   T output point and distance list
 	*/
 	template<class T>
-	T GetNN(Point Q,unsigned int nores) {
+	T GetRange(Point Q, double radius, unsigned int nores, const attr_where* where=0, const long* level=0) {
+		ReadLock rl(PointDataMutex);
+		if (PointDataSize==0)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize is zero"," when searching");
+		if (radius<0)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"radius is negative"," when searching");
+		CheckLevel(level);
+		cVec c;
+		if (where || level) RangeWhere(Q, radius, nores, c, where, level);
+		else Range(Q, radius, nores, c);
+		return Output<T>(c);
+	}
+
+	/**
+	* GetWindow: visit points in an axis aligned window, in z-order, then the inserted points
+	* not yet compacted
+	*
+	* @param L
+	*   Point lower corner
+	*
+	* @param U
+	*   Point upper corner
+	*
+	* @param nores
+	*   unsigned long max no of results, 0 for all
+	*
+	* @param visit
+	*   V visitor called as bool visit(id, dist, attr) for each point, false stops
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points
+	*
+	* @return
+	*   none
+	*/
+	template<class V>
+	void GetWindow(Point L, Point U, unsigned int nores, V& visit, const attr_where* where=0, const long* level=0) {
+		ReadLock rl(PointDataMutex);
 		if (PointDataSize==0)
 			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"PointDataSize is zero"," when searching");
-		std::vector<OutT> aout;
+		CheckLevel(level);
+		for (unsigned int j=0; j<Dim; ++j) {
+			if (U[j]<L[j]) std::swap(L[j],U[j]);
+		}
+		WindowVisit<V> w(*this, nores, visit, where, level);
+		if (!PointDataSfc->wsearch(L, U, w)) return;
+		for (std::size_t i=0; i<DeltaVec.size(); ++i) {
+			bool inside=true;
+			for (unsigned int j=0; j<Dim && inside; ++j) {
+				inside = !(DeltaVec[i][j]<L[j] || U[j]<DeltaVec[i][j]);
+			}
+			if (inside && PointDataLive[DeltaIds[i]] && !w.Visit(DeltaIds[i])) return;
+		}
+	}
+
+private:
+	typedef boost::shared_ptr<SfcT> SfcP;
+	typedef boost::shared_lock<boost::shared_mutex> ReadLock;
+	typedef boost::unique_lock<boost::shared_mutex> WriteLock;
+	typedef std::vector<std::pair<double,long unsigned int> > cVec;
+	typedef typename aVec::Match MatchT;
+
+	/**
+	* LevelView : SFC of the points up to a level, and the id of each of its points
+	*/
+	struct LevelView {
+		long Level;
+		SfcP Sfc;
+		typename SfcT::lVec Ids;
+	};
+
+	/**
+	* NoWhere : no conditions on the attributes
+	*/
+	static const attr_where& NoWhere() {
+		static const attr_where w;
+		return w;
+	}
+
+	/**
+	* LiveMatch : accepts the live points of an SFC, by position, whose attributes match
+	* and whose level is at most level, if given, it lives on the stack of the search
+	*/
+	class LiveMatch : public sfc_filter {
+	public:
+		LiveMatch(const PointData& p, const typename SfcT::lVec* ids, const attr_where* where, const long* level)
+			: p_(p), ids_(ids), m_(p.AttrDataVec, where ? *where : NoWhere()), where_(where!=0), level_(level) {}
+		bool accept(long unsigned int i) const {
+			return Matches(Id(i));
+		}
+		/** id of the point at position i of the SFC */
+		long unsigned int Id(long unsigned int i) const {
+			return ids_ ? (*ids_)[i] : i;
+		}
+		bool Matches(long unsigned int id) const {
+			return p_.PointDataLive[id] && (!level_ || p_.PointDataLevel[id] <= *level_) && (!where_ || m_(id));
+		}
+	private:
+		const PointData& p_;
+		const typename SfcT::lVec* ids_;
+		MatchT m_;
+		bool where_; // m_ is only asked with conditions
+		const long* level_;
+	};
+
+	/**
+	* WindowVisit : adapts a GetWindow visitor to the SfcData window search
+	*/
+	template<class V>
+	class WindowVisit {
+	public:
+		WindowVisit(PointData& p, unsigned int nores, V& visit, const attr_where* where, const long* level)
+			: p_(p), left_(nores), limited_(nores>0), visit_(visit), m_(p, 0, where, level) {}
+		bool operator()(long unsigned int id) {
+			return !p_.PointDataLive[id] || Visit(id);
+		}
+		bool Visit(long unsigned int id) {
+			if (!m_.Matches(id)) return true;
+			if (!visit_(id, 0.0, p_.AttrDataVec[std::size_t(id)])) return false;
+			return !(limited_ && --left_==0);
+		}
+	private:
+		PointData& p_;
+		unsigned int left_;
+		bool limited_;
+		V& visit_;
+		LiveMatch m_;
+	};
+
+	/**
+	* Permute : renumber the points of a new SFC in curve order and move the attributes
+	* to match, so that the attributes of points found together are near each other,
+	* the attributes are held twice till done
+	*/
+	void Permute() {
+		typename SfcT::lVec order;
+		PointDataSfc->Renumber(order);
+		AttrDataVec.permute(order);
+	}
+
+	/**
+	* HasLevel : true if the index has a level field
+	*/
+	bool HasLevel() const {
+		return PointDataPointOpts.level!=~0U;
+	}
+
+	/**
+	* LevelOf : the level of a point by its attributes, LONG_MAX if not an integer
+	*/
+	template<class R>
+	long LevelOf(const R& a) const {
+		if (PointDataPointOpts.level>=a.size()) return LONG_MAX;
+		return ParseLevel(a[PointDataPointOpts.level]);
+	}
+
+	/**
+	* ParseLevel : integer value of a field read in place as strtol reads it, out of range
+	* values clamped, LONG_MAX if it is not an integer
+	*/
+	template<class F>
+	static long ParseLevel(const F& f) {
+		const char* p=f.data();
+		const char* e=p+f.size();
+		while (p<e && std::isspace((unsigned char)*p)) ++p;
+		bool neg=false;
+		if (p<e && (*p=='-' || *p=='+')) neg=(*p++=='-');
+		if (p==e) return LONG_MAX;
+		const unsigned long lim = neg ? (unsigned long)LONG_MAX+1 : (unsigned long)LONG_MAX;
+		unsigned long v=0;
+		for (; p<e; ++p) {
+			if (*p<'0' || *p>'9') return LONG_MAX;
+			unsigned long d=*p-'0';
+			v = (v > (lim-d)/10) ? lim : v*10+d;
+		}
+		if (!neg) return long(v);
+		return (v==0) ? 0 : -long(v-1)-1;
+	}
+
+	/**
+	* Views : the SFCs of the points up to each of their levels but the highest, and of
+	* the lowest DSH_POINT_DATA_MAX_LEVELS if more, top is the lowest level without one
+	*/
+	void Views(const pVec& pts, const typename SfcT::lVec& ids, const std::vector<long>& levels,
+	           std::vector<LevelView>& views, long& top) const {
+		std::vector<long> values(levels);
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+		std::size_t n = std::min<std::size_t>(values.empty() ? 0 : values.size()-1, DSH_POINT_DATA_MAX_LEVELS);
+		top = (n<values.size()) ? values[n] : LONG_MIN;
+		sfc_options opts(PointDataOpts);
+		opts.permute=false;
+		views.resize(n);
+		for (std::size_t v=0; v<n; ++v) {
+			pVec run;
+			views[v].Level=values[v];
+			for (std::size_t i=0; i<pts.size(); ++i) {
+				if (levels[i]>values[v]) continue;
+				run.push_back(pts[i]);
+				views[v].Ids.push_back(ids[i]);
+			}
+			views[v].Sfc=SfcP(new SfcT(run, opts));
+		}
+	}
+
+	/**
+	* Part : the SFC to search for points up to a level and the ids of its points, the
+	* view of the level below or at it, none if there is none, the whole SFC if no level
+	* or the level has no view
+	*/
+	SfcT* Part(const long* level, const typename SfcT::lVec*& ids) const {
+		ids=0;
+		if (!level || *level>=PointDataLevelTop) return PointDataSfc.get();
+		std::size_t v=PointDataViews.size();
+		while (v>0 && PointDataViews[v-1].Level>*level) --v;
+		if (v==0) return 0;
+		ids=&PointDataViews[v-1].Ids;
+		return PointDataViews[v-1].Sfc.get();
+	}
+
+	/**
+	* CheckLevel : throws if a search is for a level and the index has no level field
+	*/
+	void CheckLevel(const long* level) const {
+		if (level && !HasLevel())
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"index has no level"," when searching");
+	}
+
+	/**
+	* CheckUpdate : throws unless the index is locked and takes updates
+	*/
+	void CheckUpdate(const char* when) const {
+		if (!PointDataSfc)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"index not locked",when);
+		if (PointDataPointOpts.delta==0)
+			throw apn::GenericException(DSH_POINT_DATA_HPP_PROGNO,"index is read only",when);
+	}
+
+	/**
+	* Kill : marks a point deleted, the caller holds the exclusive lock
+	*/
+	bool Kill(long unsigned int id) {
+		if (id>=PointDataLive.size() || !PointDataLive[id]) return false;
+		PointDataLive[id]=false;
+		++PointDataDead;
+		--PointDataSize;
+		return true;
+	}
+
+	/**
+	* StartCompact : true if a compaction is due and none is running, the caller holds the
+	* exclusive lock and starts it
+	*/
+	bool StartCompact() {
+		if (PointDataCompacting || DeltaVec.size()+PointDataDead < PointDataPointOpts.delta) return false;
+		PointDataCompacting=true;
+		return true;
+	}
+
+	/**
+	* CompactBackground : Compact on its own thread
+	*/
+	void CompactBackground() {
+		try {
+			Compact();
+		} catch (...) {
+			std::cerr << "Compaction failed" << std::endl;
+			WriteLock wl(PointDataMutex);
+			PointDataCompacting=false;
+		}
+	}
+
+	/**
+	* Nearest : live nearest points of the SFC and the delta buffer, the caller holds a lock
+	*/
+	void Nearest(const Point& Q, unsigned int nores, cVec& c, sfc_budget* budget) {
+		c.clear();
+		if (nores>PointDataSize) nores=PointDataSize;
+		if (nores==0) return;
+		/** at most PointDataDead of the points found are dead, but few are near any one query */
+		typename SfcT::lVec answer;
+		typename SfcT::dVec distance;
+		unsigned long want = nores + std::min<unsigned long>(nores, PointDataDead);
+		PointDataSfc->ksearch(Q, want, answer,distance,0,budget);
+		Live(answer, distance, c);
+		if (c.size()<nores && answer.size()==want && want<nores+PointDataDead) {
+			c.clear();
+			PointDataSfc->ksearch(Q, (unsigned long)(nores+PointDataDead), answer,distance,0,budget);
+			Live(answer, distance, c);
+		}
+		if (!DeltaVec.empty()) {
+			DeltaScan(Q, -1, c);
+			if (c.size()>nores) std::partial_sort(c.begin(), c.begin()+nores, c.end());
+			else std::sort(c.begin(), c.end());
+		}
+		if (c.size()>nores) c.resize(nores);
+	}
+
+	/**
+	* Range : live points of the SFC and the delta buffer within radius, the caller holds a lock
+	*/
+	void Range(const Point& Q, double radius, unsigned int nores, cVec& c) {
+		c.clear();
 		typename SfcT::lVec answer;
 		typename SfcT::dVec distance;
+		unsigned long want = (nores>0) ? nores + std::min<unsigned long>(nores, PointDataDead) : 0;
+		PointDataSfc->rsearch(Q, radius, want, answer, distance);
+		Live(answer, distance, c);
+		if (c.size()<nores && answer.size()==want && want<nores+PointDataDead) {
+			c.clear();
+			PointDataSfc->rsearch(Q, radius, nores+PointDataDead, answer, distance);
+			Live(answer, distance, c);
+		}
+		if (!DeltaVec.empty()) {
+			std::size_t n=c.size();
+			DeltaScan(Q, radius*radius, c);
+			if (c.size()>n) std::sort(c.begin(), c.end());
+		}
+		if (nores>0 && c.size()>nores) c.resize(nores);
+	}
+
+	/**
+	* NearestWhere : as Nearest, of the points whose attributes match and up to a level, the
+	* SFC search skips the dead points and those that do not match so it needs no extra
+	*/
+	void NearestWhere(const Point& Q, unsigned int nores, cVec& c, sfc_budget* budget, const attr_where* where, const long* level) {
+		c.clear();
 		if (nores>PointDataSize) nores=PointDataSize;
-		PointDataSfc.ksearch(Q, (unsigned long)nores, answer,distance,0);
+		if (nores==0) return;
+		const typename SfcT::lVec* ids;
+		SfcT* sfc = Part(level, ids);
+		LiveMatch m(*this, ids, where, level);
+		if (sfc) {
+			typename SfcT::lVec answer;
+			typename SfcT::dVec distance;
+			sfc->ksearch(Q, nores, answer,distance,0,budget,&m);
+			for (std::size_t i=0; i<answer.size(); ++i) c.push_back(std::make_pair(distance[i], m.Id(answer[i])));
+		}
+		if (!DeltaVec.empty()) {
+			DeltaScan(Q, -1, c, &m);
+			if (c.size()>nores) std::partial_sort(c.begin(), c.begin()+nores, c.end());
+			else std::sort(c.begin(), c.end());
+		}
+		if (c.size()>nores) c.resize(nores);
+	}
+
+	/**
+	* RangeWhere : as Range, of the points whose attributes match and up to a level
+	*/
+	void RangeWhere(const Point& Q, double radius, unsigned int nores, cVec& c, const attr_where* where, const long* level) {
+		c.clear();
+		const typename SfcT::lVec* ids;
+		SfcT* sfc = Part(level, ids);
+		LiveMatch m(*this, ids, where, level);
+		if (sfc) {
+			typename SfcT::lVec answer;
+			typename SfcT::dVec distance;
+			sfc->rsearch(Q, radius, nores, answer, distance, &m);
+			for (std::size_t i=0; i<answer.size(); ++i) c.push_back(std::make_pair(distance[i], m.Id(answer[i])));
+		}
+		if (!DeltaVec.empty()) {
+			std::size_t n=c.size();
+			DeltaScan(Q, radius*radius, c, &m);
+			if (c.size()>n) std::sort(c.begin(), c.end());
+		}
+		if (nores>0 && c.size()>nores) c.resize(nores);
+	}
+
+	/**
+	* Live : appends the live points of an SFC answer with their ids
+	*/
+	void Live(const typename SfcT::lVec& answer, const typename SfcT::dVec& distance, cVec& c) const {
 		for (std::size_t i=0; i<answer.size(); ++i) {
-			aout.push_back(boost::make_tuple(answer[i],ceil(sqrt(distance[i])), AttrDataVec[std::size_t(answer[i])]));
+			long unsigned int id=answer[i];
+			if (PointDataLive[id]) c.push_back(std::make_pair(distance[i], id));
+		}
+	}
+
+	/**
+	* DeltaScan : appends the live points of the delta buffer within sqrt(r_sq), all if r_sq<0,
+	* only those that match if given
+	*/
+	void DeltaScan(const Point& Q, double r_sq, cVec& c, const LiveMatch* m=0) const {
+		for (std::size_t i=0; i<DeltaVec.size(); ++i) {
+			if (!PointDataLive[DeltaIds[i]]) continue;
+			double d=0;
+			for (unsigned int j=0; j<Dim; ++j) {
+				double t=double(DeltaVec[i][j])-double(Q[j]);
+				d+=t*t;
+			}
+			if ((r_sq<0 || d<=r_sq) && (!m || m->Matches(DeltaIds[i]))) c.push_back(std::make_pair(d, DeltaIds[i]));
+		}
+	}
+
+	/**
+	* Output : adds the attributes to the points found
+	*/
+	template<class T>
+	T Output(const cVec& c) const {
+		T aout;
+		for (std::size_t i=0; i<c.size(); ++i) {
+			aout.push_back(boost::make_tuple(c[i].second,ceil(sqrt(c[i].first)), AttrDataVec[std::size_t(c[i].second)]));
 		}
 		return aout;
 	}
 
-private:
 	/* data */
 	pVec PointDataVec;
-	SfcT PointDataSfc;
+	SfcP PointDataSfc;
 	aVec AttrDataVec;
 	unsigned long int PointDataSize;
+	sfc_options PointDataOpts;
+	point_options PointDataPointOpts;
+
+	/* levels */
+	std::vector<long> PointDataLevel;
+	std::vector<LevelView> PointDataViews;
+	long PointDataLevelTop;
+
+	/* updates */
+	std::vector<bool> PointDataLive;
+	pVec DeltaVec;
+	typename SfcT::lVec DeltaIds;
+	unsigned long int PointDataDead;
+	bool PointDataCompacting;
+	boost::shared_mutex PointDataMutex;
+	boost::mutex CompactMutex;
 
 	/**
 	* Constructor : private Constructor
 	*
-	* @param progname
-	*   String executable name
+	* @param opts
+	*   sfc_options index build and search options
 	*
-	* @param MyCFG
-	*   apn::CfgFileOptions ConfigFile Options
+	* @param popts
+	*   point_options options of the attributes
 	*
 	* @return
 	*   none
 	*/
-	PointData() : PointDataSize(0) {}
+	PointData(const sfc_options& opts, const point_options& popts) : AttrDataVec(popts.dict), PointDataSize(0), PointDataOpts(opts), PointDataPointOpts(popts), PointDataLevelTop(LONG_MIN), PointDataDead(0), PointDataCompacting(false) {}
 
 };
 } //namespace dsh
@@ -0,0 +1,348 @@
+/**
+* @project dishante
+* @file include/dsh/PointIndex.hpp
+* @author  S Roychowdhury <sroycode AT gmail DOT com>
+* @version 1.0
+*
+* @section LICENSE
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details at
+* http://www.gnu.org/copyleft/gpl.html
+*
+* @section DESCRIPTION
+*
+* PointIndex is a PointData of any coordinate type and dimension behind one interface,
+* so that indexes of different types can be kept side by side.  Coordinates come in as
+* text and are converted to the type of the index, the searches themselves run on the
+* PointData of that type.  A geo index takes the longitude and the latitude in degrees
+* and searches its GeoEcef points with distances in metres.
+*
+*/
+
+#ifndef _DSH_POINT_INDEX_HPP_
+#define _DSH_POINT_INDEX_HPP_
+#define DSH_POINT_INDEX_HPP_PROGNO 1114
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <apn/Convert.hpp>
+#include "PointData.hpp"
+#include "GeoEcef.hpp"
+
+namespace dsh {
+template <class AttrT>
+class PointIndex : private boost::noncopyable {
+public:
+	typedef boost::shared_ptr< PointIndex<AttrT> > pointer;
+	typedef std::vector<std::string> cVec;
+	typedef typename attr_store<AttrT>::type::row_type RowT;
+	typedef boost::tuple<long unsigned int,double,RowT> OutT;
+	typedef std::vector<OutT> oVec;
+	typedef boost::function<bool (long unsigned int, double, const RowT&)> VisitT;
+	typedef boost::function<bool (const RowT&)> MatchT;
+
+	/**
+	* Create : new empty index of a coordinate type and dimension
+	*
+	* @param opts
+	*   sfc_options index build and search options
+	*
+	* @param popts
+	*   point_options options of the attributes
+	*
+	* @param geo
+	*   bool true for a geo index, which takes 2 coordinates and keeps 3
+	*
+	* @return
+	*   pointer
+	*/
+	template <class CoordT, unsigned int Dim>
+	static pointer Create(const sfc_options& opts, const point_options& popts, bool geo=false);
+
+	/**
+	* virtual destructor
+	*/
+	virtual ~PointIndex() {}
+
+	/**
+	* Dim : no of coordinates a point is given by
+	*/
+	virtual unsigned int Dim() const =0;
+
+	/**
+	* Add : add a point, once locked it is inserted
+	*
+	* @param C
+	*   cVec coordinates
+	*
+	* @param a
+	*   AttrT attributes
+	*
+	* @return
+	*   none
+	*/
+	virtual void Add(const cVec& C, const AttrT& a) =0;
+
+	/**
+	* Lock : make ready to search
+	*/
+	virtual void Lock() =0;
+
+	/**
+	* GetNN : find nearest points
+	*
+	* @param C
+	*   cVec coordinates of the query
+	*
+	* @param nores
+	*   unsigned int no of results
+	*
+	* @param budget
+	*   sfc_budget* optional work budget, also returns whether the answer is exact
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points, on an index with a level field
+	*
+	* @return
+	*   oVec output point and distance list
+	*/
+	virtual oVec GetNN(const cVec& C, unsigned int nores, sfc_budget* budget=0, const attr_where* where=0, const long* level=0) =0;
+
+	/**
+	* GetNNBatch : find nearest points for many queries in one sweep
+	*
+	* @param C
+	*   std::vector<cVec> coordinates of the queries
+	*
+	* @param nores
+	*   unsigned int no of results per query
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points, on an index with a level field
+	*
+	* @return
+	*   std::vector<oVec> output point and distance list per query
+	*/
+	virtual std::vector<oVec> GetNNBatch(const std::vector<cVec>& C, unsigned int nores, const attr_where* where=0, const long* level=0) =0;
+
+	/**
+	* GetRange : find points within a radius
+	*
+	* @param C
+	*   cVec coordinates of the query
+	*
+	* @param radius
+	*   double search radius
+	*
+	* @param nores
+	*   unsigned int max no of results, nearest first, 0 for all
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points, on an index with a level field
+	*
+	* @return
+	*   oVec output point and distance list
+	*/
+	virtual oVec GetRange(const cVec& C, double radius, unsigned int nores, const attr_where* where=0, const long* level=0) =0;
+
+	/**
+	* GetWindow : visit points in an axis aligned window
+	*
+	* @param L
+	*   cVec lower corner
+	*
+	* @param U
+	*   cVec upper corner
+	*
+	* @param nores
+	*   unsigned int max no of results, 0 for all
+	*
+	* @param visit
+	*   VisitT called for each point, false stops
+	*
+	* @param where
+	*   attr_where* optional conditions on the attributes of the points
+	*
+	* @param level
+	*   long* optional highest level of the points, on an index with a level field
+	*
+	* @return
+	*   none
+	*/
+	virtual void GetWindow(const cVec& L, const cVec& U, unsigned int nores, VisitT visit, const attr_where* where=0, const long* level=0) =0;
+
+	/**
+	* RemoveAt : delete the points at a location whose attributes match
+	*
+	* @param C
+	*   cVec coordinates
+	*
+	* @param match
+	*   MatchT true deletes the point
+	*
+	* @return
+	*   unsigned int no of points deleted
+	*/
+	virtual unsigned int RemoveAt(const cVec& C, MatchT match) =0;
+
+protected:
+	/**
+	* ToPoint : the point of some coordinates in the type of an index
+	*/
+	template <class Point>
+	static Point ToPoint(const cVec& C) {
+		Point P;
+		if (C.size()!=P.size())
+			throw apn::GenericException(DSH_POINT_INDEX_HPP_PROGNO,"bad dimension"," of point");
+		for (std::size_t j=0; j<P.size(); ++j) {
+			P[j]=apn::Convert::AnyToAny<std::string,typename Point::value_type>(C[j]);
+		}
+		return P;
+	}
+};
+
+/**
+* PointIndexOf : index of points of a coordinate type and dimension
+*/
+template <class CoordT, class AttrT, unsigned int D>
+class PointIndexOf : public PointIndex<AttrT> {
+public:
+	typedef PointIndex<AttrT> base;
+	typedef PointData<CoordT,AttrT,D> PD;
+	typedef typename base::cVec cVec;
+	typedef typename base::oVec oVec;
+
+	PointIndexOf(const sfc_options& opts, const point_options& popts) : p(PD::create(opts, popts)) {}
+
+	unsigned int Dim() const {
+		return D;
+	}
+	void Add(const cVec& C, const AttrT& a) {
+		p->Add(Pt(C), a);
+	}
+	void Lock() {
+		p->Lock();
+	}
+	oVec GetNN(const cVec& C, unsigned int nores, sfc_budget* budget=0, const attr_where* where=0, const long* level=0) {
+		return p->template GetNN<oVec>(Pt(C), nores, budget, where, level);
+	}
+	std::vector<oVec> GetNNBatch(const std::vector<cVec>& C, unsigned int nores, const attr_where* where=0, const long* level=0) {
+		typename PD::pVec Q(C.size());
+		for (std::size_t i=0; i<C.size(); ++i) Q[i]=Pt(C[i]);
+		return p->template GetNNBatch<oVec>(Q, nores, where, level);
+	}
+	oVec GetRange(const cVec& C, double radius, unsigned int nores, const attr_where* where=0, const long* level=0) {
+		return p->template GetRange<oVec>(Pt(C), radius, nores, where, level);
+	}
+	void GetWindow(const cVec& L, const cVec& U, unsigned int nores, typename base::VisitT visit, const attr_where* where=0, const long* level=0) {
+		p->GetWindow(Pt(L), Pt(U), nores, visit, where, level);
+	}
+	unsigned int RemoveAt(const cVec& C, typename base::MatchT match) {
+		return p->RemoveAt(Pt(C), match);
+	}
+
+private:
+	typename PD::pointer p;
+
+	static typename PD::Point Pt(const cVec& C) {
+		return base::template ToPoint<typename PD::Point>(C);
+	}
+};
+
+/**
+* GeoIndexOf : geo index of a coordinate type, points are given as longitude,latitude
+*/
+template <class CoordT, class AttrT>
+class GeoIndexOf : public PointIndex<AttrT> {
+public:
+	typedef PointIndex<AttrT> base;
+	typedef PointData<CoordT,AttrT,3> PD;
+	typedef GeoEcef<typename PD::Point> GeoT;
+	typedef typename base::cVec cVec;
+	typedef typename base::oVec oVec;
+
+	GeoIndexOf(const sfc_options& opts, const point_options& popts) : p(PD::create(opts, popts)) {}
+
+	unsigned int Dim() const {
+		return 2;
+	}
+	void Add(const cVec& C, const AttrT& a) {
+		p->Add(Pt(C), a);
+	}
+	void Lock() {
+		p->Lock();
+	}
+	/** radius and distances are great circle metres */
+	oVec GetNN(const cVec& C, unsigned int nores, sfc_budget* budget=0, const attr_where* where=0, const long* level=0) {
+		oVec a = p->template GetNN<oVec>(Pt(C), nores, budget, where, level);
+		Metres(a);
+		return a;
+	}
+	std::vector<oVec> GetNNBatch(const std::vector<cVec>& C, unsigned int nores, const attr_where* where=0, const long* level=0) {
+		typename PD::pVec Q(C.size());
+		for (std::size_t i=0; i<C.size(); ++i) Q[i]=Pt(C[i]);
+		std::vector<oVec> a = p->template GetNNBatch<oVec>(Q, nores, where, level);
+		for (std::size_t i=0; i<a.size(); ++i) Metres(a[i]);
+		return a;
+	}
+	oVec GetRange(const cVec& C, double radius, unsigned int nores, const attr_where* where=0, const long* level=0) {
+		oVec a = p->template GetRange<oVec>(Pt(C), GeoT::Chord(radius), nores, where, level);
+		Metres(a);
+		return a;
+	}
+	void GetWindow(const cVec&, const cVec&, unsigned int, typename base::VisitT, const attr_where* =0, const long* =0) {
+		throw apn::GenericException(DSH_POINT_INDEX_HPP_PROGNO,"not on a geo index"," when searching a window");
+	}
+	unsigned int RemoveAt(const cVec& C, typename base::MatchT match) {
+		return p->RemoveAt(Pt(C), match);
+	}
+
+private:
+	typename PD::pointer p;
+
+	static typename PD::Point Pt(const cVec& C) {
+		if (C.size()!=2)
+			throw apn::GenericException(DSH_POINT_INDEX_HPP_PROGNO,"bad dimension"," of geo point");
+		return GeoT::FromLatLon(
+		           apn::Convert::AnyToAny<std::string,double>(C[1]),
+		           apn::Convert::AnyToAny<std::string,double>(C[0]));
+	}
+
+	static void Metres(oVec& a) {
+		for (std::size_t i=0; i<a.size(); ++i) {
+			a[i].template get<1>() = std::ceil(GeoT::Metres(a[i].template get<1>()));
+		}
+	}
+};
+
+template <class AttrT>
+template <class CoordT, unsigned int Dim>
+typename PointIndex<AttrT>::pointer PointIndex<AttrT>::Create(const sfc_options& opts, const point_options& popts, bool geo)
+{
+	if (geo) return pointer(new GeoIndexOf<CoordT,AttrT>(opts, popts));
+	return pointer(new PointIndexOf<CoordT,AttrT,Dim>(opts, popts));
+}
+} //namespace dsh
+#endif /* _DSH_POINT_INDEX_HPP_ */
@@ -21,6 +21,12 @@
 *
 * SFC Data Objects : the wrapper class acts as ext interface for Nearest Neighbour search class
 *
+* A quantized index keeps integral points as unsigned 32 bit offsets from an origin below
+* their bounding box, with the box centered in the 2^32 wide frame so that queries around
+* it can be offset too.  Distances between offsets are those between the points, so the
+* answers are the same.  Queries outside the frame are clamped to it, and searched in a
+* window next to the clamped query that holds every point of the answer.
+*
 */
 
 #ifndef _DSH_SFCDATA_HPP_
@@ -28,6 +34,9 @@
 #define DSH_SFCDATA_HPP_PROGNO 1111
 
 #include <vector>
+#include <climits>
+#include <algorithm>
+#include <boost/array.hpp>
 #include "_STANN/sfcdata_work.hpp"
 #include <apn/Exception.hh>
 
@@ -44,11 +53,28 @@ public:
 	* @param PointArr
 	*   ArrT Array of input Points
 	*
+	* @param opts
+	*   sfc_options build and search options
+	*
 	*/
-	SfcData(ArrT& PointArr) : max(PointArr.size()) {
+	SfcData(ArrT& PointArr, const sfc_options& opts = sfc_options()) : max(PointArr.size()), quantized(false) {
 		if (sizeof(NumType) != sizeof(typename ArrT::value_type::value_type))
 			throw apn::GenericException(DSH_SFCDATA_HPP_PROGNO,"sfcnn Numeric Type Mismatch","");
-		if (! NN.sfcnn_do_init(PointArr))
+		if (opts.quantize && Frame(PointArr)) {
+			std::vector<boost::array<unsigned int, Dim> > qa(PointArr.size());
+			QPoint qp;
+			for (std::size_t i=0; i < PointArr.size(); ++i) {
+				/** the frame is that of these points */
+				if (! Offset(PointArr[i], qp))
+					throw apn::GenericException(DSH_SFCDATA_HPP_PROGNO,"point outside the frame","");
+				for (unsigned int j=0; j < Dim; ++j) qa[i][j]=qp[j];
+			}
+			if (! QN.sfcnn_do_init(qa, opts))
+				throw apn::GenericException(DSH_SFCDATA_HPP_PROGNO,"Cannot init Sfc Data","");
+			quantized=true;
+			return;
+		}
+		if (! NN.sfcnn_do_init(PointArr, opts))
 			throw apn::GenericException(DSH_SFCDATA_HPP_PROGNO,"Cannot init Sfc Data","");
 	};
 
@@ -76,10 +102,17 @@ public:
 	template <typename T>
 	void ksearch(T q, unsigned int k, lVec &nn_idx, float eps = 0) {
 		k=(k>max)?max:k;
-		reviver::dpoint<NumType, Dim> qry;
+		Point qry;
 		for (unsigned int j=0; j < Dim; ++j) {
 			qry[j]=q[j];
 		}
+		if (quantized) {
+			QPoint qq;
+			dVec dist;
+			if (Offset(qry, qq)) QN.ksearch(qq,k,nn_idx,eps);
+			else Outside(qry, k, -1, nn_idx, dist);
+			return;
+		}
 		NN.ksearch(qry,k,nn_idx,eps);
 	}
 
@@ -97,22 +130,375 @@ public:
 	* @param eps
 	*   float optional Error tolerence, default of 0.0.
 	*
+	* @param budget
+	*   sfc_budget* optional work budget, also returns whether the answer is exact
+	*
+	* @param filter
+	*   sfc_filter* optional filter, only points it accepts are returned
+	*
 	* @return
 	*   none
 	*/
 	template <typename T>
-	void ksearch(T q, unsigned int k, lVec &nn_idx, dVec &dist, float eps=0) {
+	void ksearch(T q, unsigned int k, lVec &nn_idx, dVec &dist, float eps=0, sfc_budget* budget=0,
+	             const sfc_filter* filter=0) {
 		k=(k>max)?max:k;
-		reviver::dpoint<NumType, Dim> qry;
+		Point qry;
 		for (unsigned int j=0; j < Dim; ++j) {
 			qry[j]=q[j];
 		}
-		NN.ksearch(qry,k,nn_idx,dist,eps);
+		if (quantized) {
+			QPoint qq;
+			if (Offset(qry, qq)) QN.ksearch(qq,k,nn_idx,dist,eps,budget,filter);
+			else {
+				long unsigned int visited = Outside(qry, k, -1, nn_idx, dist, filter);
+				if (budget) {
+					budget->visited=visited;
+					budget->exact=true;
+				}
+			}
+			return;
+		}
+		NN.ksearch(qry,k,nn_idx,dist,eps,budget,filter);
+	}
+
+	/**
+	* ksearch_batch: thread safe search for k NN points of many queries
+	*
+	* @param qs
+	*   std::vector<T> Query Points
+	* @param k
+	*   unsigned int No of results to retrieve per query
+	* @param nn_idx
+	*   std::vector<lVec> Point Ids to be populated, in order of qs
+	* @param dist
+	*   std::vector<dVec> distances corresp. to the above Point Ids to be populated
+	* @param eps
+	*   float optional Error tolerence, default of 0.0.
+	*
+	* @return
+	*   none
+	*/
+	template <typename T>
+	void ksearch_batch(const std::vector<T>& qs, unsigned int k, std::vector<lVec> &nn_idx, std::vector<dVec> &dist, float eps=0) {
+		k=(k>max)?max:k;
+		std::vector<Point> qry(qs.size());
+		for (std::size_t i=0; i < qs.size(); ++i) {
+			for (unsigned int j=0; j < Dim; ++j) {
+				qry[i][j]=qs[i][j];
+			}
+		}
+		if (quantized) {
+			/** queries in the frame go to the sweep, the others are searched one by one */
+			std::vector<QPoint> qq;
+			lVec at;
+			QPoint qp;
+			nn_idx.resize(qs.size());
+			dist.resize(qs.size());
+			for (std::size_t i=0; i < qry.size(); ++i) {
+				if (Offset(qry[i], qp)) {
+					qq.push_back(qp);
+					at.push_back(i);
+				} else Outside(qry[i], k, -1, nn_idx[i], dist[i]);
+			}
+			std::vector<lVec> qidx;
+			std::vector<dVec> qdist;
+			QN.ksearch_batch(qq,k,qidx,qdist,eps);
+			for (std::size_t i=0; i < at.size(); ++i) {
+				nn_idx[at[i]].swap(qidx[i]);
+				dist[at[i]].swap(qdist[i]);
+			}
+			return;
+		}
+		NN.ksearch_batch(qry,k,nn_idx,dist,eps);
+	}
+
+	/**
+	* rsearch: thread safe search for points within a radius
+	*
+	* @param q
+	*   T Query Point
+	* @param r
+	*   double search radius
+	* @param limit
+	*   unsigned int max no of results to retrieve, nearest first, 0 for all
+	* @param nn_idx
+	*   lVec Vector of Point Ids to be populated
+	* @param dist
+	*   dVec Vector of distances corresp. to the above Point Ids to be populated
+	*
+	* @param filter
+	*   sfc_filter* optional filter, only points it accepts are returned
+	*
+	* @return
+	*   none
+	*/
+	template <typename T>
+	void rsearch(T q, double r, unsigned int limit, lVec &nn_idx, dVec &dist, const sfc_filter* filter=0) {
+		Point qry;
+		for (unsigned int j=0; j < Dim; ++j) {
+			qry[j]=q[j];
+		}
+		if (quantized) {
+			QPoint qq;
+			if (Offset(qry, qq)) QN.rsearch(qq,r,limit,nn_idx,dist,filter);
+			else Outside(qry, limit, r*r, nn_idx, dist, filter);
+			return;
+		}
+		NN.rsearch(qry,r,limit,nn_idx,dist,filter);
+	}
+
+	/**
+	* wsearch: thread safe visit of points in an axis aligned window
+	*
+	* @param lower
+	*   T lower corner of the window
+	* @param upper
+	*   T upper corner of the window
+	* @param visit
+	*   V visitor called as bool visit(long unsigned int id), false stops
+	*
+	* @return
+	*   bool false if the visitor stopped the search
+	*/
+	template <typename T, typename V>
+	bool wsearch(T lower, T upper, V &visit) {
+		Point lo, hi;
+		for (unsigned int j=0; j < Dim; ++j) {
+			lo[j]=lower[j];
+			hi[j]=upper[j];
+		}
+		if (quantized) {
+			/** all points are in the frame, so the window is cut to it */
+			QPoint ql, qh;
+			for (unsigned int j=0; j < Dim; ++j) {
+				if (hi[j] < origin[j]) return true;
+				unsigned long int l = (lo[j] < origin[j]) ? 0 : Span(origin[j], lo[j]);
+				unsigned long int h = Span(origin[j], hi[j]);
+				if (l > UINT_MAX) return true;
+				ql[j] = (unsigned int) l;
+				qh[j] = (unsigned int) ((h > UINT_MAX) ? UINT_MAX : h);
+			}
+			return QN.wsearch(ql,qh,visit);
+		}
+		return NN.wsearch(lo,hi,visit);
+	}
+
+	/**
+	* Points: the points of the index by id, the order they were given unless renumbered
+	*
+	* @param PointArr
+	*   ArrT Array of Points to be populated
+	*
+	* @return
+	*   none
+	*/
+	void Points(ArrT& PointArr) const {
+		PointArr.resize(max);
+		for (std::size_t i=0; i < max; ++i) {
+			if (quantized) {
+				const QPoint& p = QN.point(i);
+				for (unsigned int j=0; j < Dim; ++j)
+					PointArr[QN.pointer(i)][j] = Coord(j, p[j]);
+			} else {
+				const Point& p = NN.point(i);
+				for (unsigned int j=0; j < Dim; ++j)
+					PointArr[NN.pointer(i)][j] = p[j];
+			}
+		}
+	}
+
+	/**
+	* Renumber: renumber the points by their position in the index, searches then return
+	* positions, and points near each other on the curve get ids near each other
+	*
+	* @param order
+	*   lVec set to the id of each position as given by the search before
+	*
+	* @return
+	*   none
+	*/
+	void Renumber(lVec& order) {
+		if (quantized) QN.renumber(order);
+		else NN.renumber(order);
+	}
+
+	/**
+	* size: no of points in the index
+	*
+	* @return
+	*   unsigned long no of points
+	*/
+	unsigned long int size() const {
+		return max;
+	}
+
+	/**
+	* Quantized: true if the points are kept as 32 bit offsets
+	*
+	* @return
+	*   bool quantized
+	*/
+	bool Quantized() const {
+		return quantized;
 	}
 
 private:
-	sfcdata_work<reviver::dpoint<NumType, Dim> > NN;
+	typedef reviver::dpoint<NumType, Dim> Point;
+	typedef reviver::dpoint<unsigned int, Dim> QPoint;
+
+	sfcdata_work<Point> NN;
+	sfcdata_work<QPoint, unsigned int, unsigned int> QN;
 	unsigned long int max;
+	bool quantized;
+	boost::array<NumType, Dim> origin;
+
+	/**
+	* Span : b - a of integral coordinates, b not below a
+	*/
+	static unsigned long int Span(NumType a, NumType b) {
+		return (unsigned long int)b - (unsigned long int)a;
+	}
+
+	/**
+	* Coord : coordinate of an offset on axis j
+	*/
+	NumType Coord(unsigned int j, unsigned int o) const {
+		return NumType((unsigned long int)origin[j] + o);
+	}
+
+	/**
+	* Frame : sets the origin, false if the points cannot be quantized
+	*/
+	bool Frame(const ArrT& PointArr) {
+		if (!std::numeric_limits<NumType>::is_integer || sizeof(NumType) > sizeof(unsigned long int)) return false;
+		if (PointArr.empty() || PointArr.size() > UINT_MAX) return false;
+		for (unsigned int j=0; j < Dim; ++j) {
+			NumType lo=PointArr[0][j], hi=PointArr[0][j];
+			for (std::size_t i=1; i < PointArr.size(); ++i) {
+				if (PointArr[i][j] < lo) lo=PointArr[i][j];
+				if (hi < PointArr[i][j]) hi=PointArr[i][j];
+			}
+			unsigned long int extent = Span(lo, hi);
+			if (extent > UINT_MAX) return false;
+			unsigned long int shift = (UINT_MAX - extent)/2;
+			unsigned long int room = Span((std::numeric_limits<NumType>::min)(), lo);
+			origin[j] = NumType((unsigned long int)lo - std::min(shift, room));
+		}
+		return true;
+	}
+
+	/**
+	* Offset : offset of a point, false if it is outside the frame
+	*/
+	template <typename T>
+	bool Offset(const T& p, QPoint& qp) const {
+		for (unsigned int j=0; j < Dim; ++j) {
+			if (NumType(p[j]) < origin[j]) return false;
+			unsigned long int o = Span(origin[j], p[j]);
+			if (o > UINT_MAX) return false;
+			qp[j] = (unsigned int) o;
+		}
+		return true;
+	}
+
+	/**
+	* OutsideVisit : collects the points of the window of a query outside the frame
+	*/
+	struct OutsideVisit {
+		typedef std::vector<std::pair<double, long unsigned int> > cVec;
+		OutsideVisit(const sfcdata_work<QPoint, unsigned int, unsigned int>& qn, const boost::array<NumType, Dim>& origin,
+		             const Point& q, double r_sq, const sfc_filter* filter, cVec& c)
+			: qn_(qn), origin_(origin), q_(q), r_sq_(r_sq), filter_(filter), c_(c), visited(0) {}
+		bool operator()(long unsigned int i) {
+			++visited;
+			long unsigned int id = qn_.pointer(i);
+			if (filter_ && !filter_->accept(id)) return true;
+			const QPoint& o = qn_.point(i);
+			Point p;
+			for (unsigned int j=0; j < Dim; ++j) p[j] = NumType((unsigned long int)origin_[j] + o[j]);
+			double d = p.sqr_dist(q_);
+			if (r_sq_ < 0 || d <= r_sq_) c_.push_back(std::make_pair(d, id));
+			return true;
+		}
+		const sfcdata_work<QPoint, unsigned int, unsigned int>& qn_;
+		const boost::array<NumType, Dim>& origin_;
+		const Point& q_;
+		double r_sq_;
+		const sfc_filter* filter_;
+		cVec& c_;
+		long unsigned int visited;
+	};
+
+	/**
+	* Outside : nearest k points within sqrt(r_sq) of a query outside the frame, all in range
+	* if k is 0, at any distance if r_sq<0, only those filter accepts if given.  With c the
+	* query clamped to the frame and D=q-c the gap, a point p is at G+2D.(p-c)+e from q, G
+	* being |D|^2 and e |p-c|^2, and D.(p-c) is not negative on any axis.  A bound T on the
+	* squared distance of the answer thus bounds e by T-G and the axes with a gap by
+	* (T-G)/2|Dj|, a window next to c.  A kNN search takes T from the k nearest of c, which
+	* are within sqrt(G) of them.  Returns the no of points visited.
+	*/
+	long unsigned int Outside(const Point& q, unsigned long int k, double r_sq, lVec &nn_idx, dVec &dist,
+	                          const sfc_filter* filter=0) {
+		nn_idx.clear();
+		dist.clear();
+		QPoint c;
+		double D[Dim], G=0;
+		for (unsigned int j=0; j < Dim; ++j) {
+			if (q[j] < origin[j]) {
+				c[j] = 0;
+				D[j] = (double) Span(q[j], origin[j]);
+			} else {
+				unsigned long int o = Span(origin[j], q[j]);
+				c[j] = (unsigned int) ((o > UINT_MAX) ? UINT_MAX : o);
+				D[j] = (o > UINT_MAX) ? (double) (o - UINT_MAX) : 0;
+			}
+			G += D[j]*D[j];
+		}
+		double T = r_sq;
+		if (r_sq < 0) {
+			if (k == 0) return 0;
+			lVec idx;
+			dVec e;
+			QN.ksearch(c, k, idx, e, 0, 0, filter);
+			T = (std::numeric_limits<double>::max)();
+			if (e.size() == k) T = (sqrt(G) + sqrt(e.back())) * (sqrt(G) + sqrt(e.back()));
+		}
+		/** with room for the rounding of distances this large */
+		double S = T - G + T*1e-12;
+		if (S < 0) return 0;
+		QPoint lo, hi;
+		for (unsigned int j=0; j < Dim; ++j) {
+			double w = sqrt(S) + 1;
+			if (D[j] > 0) w = std::min(w, S/(2*D[j]) + 1);
+			unsigned int W = (w < UINT_MAX) ? (unsigned int) w : UINT_MAX;
+			if (D[j] > 0 && c[j] == 0) {
+				lo[j] = 0;
+				hi[j] = W;
+			} else if (D[j] > 0) {
+				lo[j] = UINT_MAX - W;
+				hi[j] = UINT_MAX;
+			} else {
+				lo[j] = (c[j] > W) ? c[j] - W : 0;
+				hi[j] = (UINT_MAX - c[j] > W) ? c[j] + W : UINT_MAX;
+			}
+		}
+		typename OutsideVisit::cVec f;
+		OutsideVisit visit(QN, origin, q, r_sq, filter, f);
+		QN.wsearch_sorted(lo, hi, visit);
+		if (k > 0 && k < f.size()) {
+			std::partial_sort(f.begin(), f.begin()+k, f.end());
+			f.resize(k);
+		} else std::sort(f.begin(), f.end());
+		nn_idx.resize(f.size());
+		dist.resize(f.size());
+		for (std::size_t i=0; i < f.size(); ++i) {
+			dist[i] = f[i].first;
+			nn_idx[i] = f[i].second;
+		}
+		return visit.visited;
+	}
 };
 
 } //namespace dsh
@@ -141,6 +141,174 @@ long int BinarySearch(vector<Point> &A, Point q, zorder_lt<Point> lt)
 	return middle;
 }
 
+//! A binary search Function on part of a vector.
+/*
+  This function executes a binary search on the points low to high of a
+  vector of points, which must bracket the query.
+  \param A Vector of points to search
+  \param q Query point
+  \param lt A less_than comparetor
+  \param low First index searched
+  \param high Last index searched
+  \return If found: index of point. Otherwise: index of first smaller point
+*/
+template<typename Point>
+long int BinarySearch(vector<Point> &A, Point q, zorder_lt<Point> lt, long int low, long int high)
+{
+	long int middle = low;
+
+	while (low <= high) {
+		middle = (low+high)/2;
+		if (q == A[middle])
+			return middle;
+		else if (lt(q, A[middle]))
+			high = middle-1;
+		else
+			low = middle+1;
+	}
+	return middle;
+}
+
+//! A galloping search Function.
+/*
+  This function executes a search on a vector of points starting from
+  the position of a previous search.  It doubles its step away from the
+  hint until the query is bracketed and then runs a binary search inside
+  the bracket, so a run of queries sorted in z-order costs O(log d) each
+  where d is the distance moved in the array.
+  \param A Vector of points to search
+  \param q Query point
+  \param lt A less_than comparetor
+  \param hint Index returned by the previous search, negative for none
+  \return If found: index of point. Otherwise: index of first smaller point
+*/
+template<typename Point>
+long int GallopSearch(vector<Point> &A, Point q, zorder_lt<Point> lt, long int hint)
+{
+	long int size = A.size();
+	if ((hint < 0) || (hint >= size))
+		return BinarySearch(A, q, lt);
+
+	long int low, high, step = 1;
+	if (lt(q, A[hint])) {
+		high = hint;
+		low = hint - step;
+		while ((low > 0) && lt(q, A[low])) {
+			high = low;
+			step <<= 1;
+			low = hint - step;
+		}
+		if (low < 0) low = 0;
+	} else {
+		low = hint;
+		high = hint + step;
+		while ((high < size-1) && !lt(q, A[high])) {
+			low = high;
+			step <<= 1;
+			high = hint + step;
+		}
+		if (high > size-1) high = size-1;
+	}
+
+	long int middle = low;
+	while (low <= high) {
+		middle = (low+high)/2;
+		if (q == A[middle])
+			return middle;
+		else if (lt(q, A[middle]))
+			high = middle-1;
+		else
+			low = middle+1;
+	}
+	return middle;
+}
+
+//! A key search Function.
+/*
+  This function executes a binary search on a sorted vector of z-order
+  keys.  The loop has a fixed trip count and a conditional move instead
+  of an early exit, so it does not mispredict on the comparisons.
+  \param A Sorted vector of keys
+  \param q Query key
+  \return Index of the last key not greater than q, 0 if there is none
+*/
+template<typename Key>
+long int KeySearch(const vector<Key> &A, const Key &q)
+{
+	long int base = 0;
+	long int n = A.size();
+	while (n > 1) {
+		long int half = n/2;
+		base = (q < A[base+half]) ? base : base+half;
+		n -= half;
+	}
+	return base;
+}
+
+//! A key search Function on part of a vector.
+/*
+  As KeySearch, on the keys low to high-1 only.  The result is that of
+  the whole vector if the key at low is not greater than q and the key at
+  high, if there is one, is greater.
+  \param A Sorted vector of keys
+  \param q Query key
+  \param low First index searched
+  \param high One past the last index searched
+  \return Index of the last key not greater than q, low if there is none
+*/
+template<typename Key>
+long int KeySearch(const vector<Key> &A, const Key &q, long int low, long int high)
+{
+	long int base = low;
+	long int n = high-low;
+	while (n > 1) {
+		long int half = n/2;
+		base = (q < A[base+half]) ? base : base+half;
+		n -= half;
+	}
+	return base;
+}
+
+//! A galloping key search Function.
+/*
+  As KeySearch, starting from the position of a previous search.  It
+  doubles its step away from the hint until the query is bracketed and
+  then searches inside the bracket, as GallopSearch does on points.
+  \param A Sorted vector of keys
+  \param q Query key
+  \param hint Index returned by the previous search, negative for none
+  \return Index of the last key not greater than q, 0 if there is none
+*/
+template<typename Key>
+long int KeyGallopSearch(const vector<Key> &A, const Key &q, long int hint)
+{
+	long int size = A.size();
+	if ((hint < 0) || (hint >= size))
+		return KeySearch(A, q);
+
+	long int low, high, step = 1;
+	if (q < A[hint]) {
+		high = hint;
+		low = hint - step;
+		while ((low > 0) && (q < A[low])) {
+			high = low;
+			step <<= 1;
+			low = hint - step;
+		}
+		if (low < 0) low = 0;
+	} else {
+		low = hint;
+		high = hint + step;
+		while ((high < size) && !(q < A[high])) {
+			low = high;
+			step <<= 1;
+			high = hint + step;
+		}
+		if (high > size) high = size;
+	}
+	return KeySearch(A, q, low, high);
+}
+
 //! A binary search Function.
 /*
   This function executes a binary search on an array of points
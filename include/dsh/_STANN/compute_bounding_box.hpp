@@ -19,6 +19,7 @@
   \brief Function objects to compute bounding boxes for points
   of various data types
 */
+#include <cmath>
 #include "sep_float.hpp"
 
 using namespace std;
@@ -29,6 +30,14 @@ public:
 
 	static inline void eval(Point q, Point &q1, Point &q2, double R, Ptype max, Ptype min) {
 		Ptype radius;
+		if (R >= (double) max) {
+			// radius does not fit the type, the whole space is in the box
+			for (unsigned int i=0; i<Point::__DIM; ++i) {
+				q1[i] = min;
+				q2[i] = max;
+			}
+			return;
+		}
 		R = ceil(R);
 
 		radius = (Ptype) R;
@@ -43,20 +52,32 @@ public:
 	}
 };
 
+/*
+  Float boxes are computed in double and rounded outwards.  A float has
+  24 bits of precision, so q+-(float)R in float arithmetic can fall short
+  of q+-R by several units once q is above 2^24 and leave points out.
+*/
+inline float cbb_float_down(double d, float min) {
+	if (d <= (double) min) return min;
+	float f = (float) d;
+	if ((double) f > d) f = nextafterf(f, min);
+	return f;
+}
+inline float cbb_float_up(double d, float max) {
+	if (d >= (double) max) return max;
+	float f = (float) d;
+	if ((double) f < d) f = nextafterf(f, max);
+	return f;
+}
+
 template<typename Point>
 class cbb_work<Point, float> {
 public:
 
 	static inline void eval(Point q, Point &q1, Point &q2, double R, float max, float min) {
-		float radius;
-		radius = (float) R;
-
 		for (unsigned int i=0; i<Point::__DIM; ++i) {
-			if (q[i] < (min+radius)) q1[i] = min;
-			else q1[i] = (q[i]-radius);
-
-			if (q[i] > (max-radius)) q2[i] = max;
-			else q2[i] = (q[i]+radius);
+			q1[i] = cbb_float_down((double) q[i] - R, min);
+			q2[i] = cbb_float_up((double) q[i] + R, max);
 		}
 	}
 };
@@ -66,13 +87,10 @@ class cbb_work<Point, sep_float<float> > {
 public:
 
 	static inline void eval(Point q, Point &q1, Point &q2, double R, sep_float<float> max, sep_float<float> min) {
-		sep_float<float> radius = (float) R;
 		for (unsigned int i=0; i<Point::__DIM; ++i) {
-			if (q[i] < (min+radius)) q1[i] = min;
-			else q1[i] = (q[i]-radius);
-
-			if (q[i] > (max-radius)) q2[i] = max;
-			else q2[i] = (q[i]+radius);
+			double x = q[i].get_flt();
+			q1[i] = cbb_float_down(x - R, min.get_flt());
+			q2[i] = cbb_float_up(x + R, max.get_flt());
 		}
 	}
 };
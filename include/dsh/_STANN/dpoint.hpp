@@ -237,9 +237,10 @@ public:
 		origin<NumType, D, D-1>::eval(*this);
 	};
 
+	// at the origin, a vector of points is sized by copying one
 	dpoint() {
 		Assert( (D >= 1), "Dimension < 1 not allowed" );
-		// move2origin();
+		move2origin();
 	};
 
 	// 1 D Point
@@ -0,0 +1,83 @@
+/*****************************************************************************/
+/*                                                                           */
+/*  Header: hilbert_key.hpp                                                  */
+/*                                                                           */
+/*  Accompanies STANN Version 0.70 B                                         */
+/*                                                                           */
+/*  (added by Shreos Roychowdhury)                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SFCNN_HILBERT_KEY__
+#define __SFCNN_HILBERT_KEY__
+
+#include "zorder_key.hpp"
+
+/*! \file
+  \brief Precomputed Hilbert curve keys
+
+  The key of a point is its index along the Hilbert curve, computed with
+  J. Skilling's transform ("Programming the Hilbert curve", AIP Conf.
+  Proc. 707, 2004): the coordinates are transposed in place into the
+  Hilbert index and the result is interleaved like a z-order key.  Keys
+  have the same layout as zorder_key, so the same sort and search work
+  on both.  Like the z-order, every quadtree cell is one contiguous
+  range of keys, but consecutive cells always share a face.
+*/
+
+//! Hilbert key
+/*! \brief Computes the Hilbert curve key of a point */
+template<typename Point>
+class hilbert_key {
+public:
+	typedef zorder_key<Point> base;
+	typedef typename base::key_type key_type;
+	static const unsigned int DIM = base::DIM;
+	static const unsigned int BITS = base::BITS;
+
+	/*! True if keys can be made for this coordinate type */
+	static const bool valid = base::valid;
+
+	/*! Make key
+	  \param p Point
+	  \param k Return value, key of p
+	*/
+	static void make(const Point &p, key_type &k) {
+		unsigned long int x[DIM];
+		for (unsigned int d=0; d < DIM; ++d)
+			x[d] = base::coord::encode(p[d]);
+		make_encoded(x, k);
+	}
+
+	/*! Make key from encoded coordinates
+	  \param x Coordinates mapped by zorder_key_coord, overwritten
+	  \param k Return value, key
+	*/
+	static void make_encoded(unsigned long int *x, key_type &k) {
+		const unsigned long int M = 1UL << (BITS-1);
+		// inverse undo
+		for (unsigned long int Q = M; Q > 1; Q >>= 1) {
+			unsigned long int P = Q-1;
+			for (unsigned int d=0; d < DIM; ++d) {
+				if (x[d] & Q) {
+					x[0] ^= P;
+				} else {
+					unsigned long int t = (x[0]^x[d]) & P;
+					x[0] ^= t;
+					x[d] ^= t;
+				}
+			}
+		}
+		// gray encode
+		for (unsigned int d=1; d < DIM; ++d)
+			x[d] ^= x[d-1];
+		unsigned long int t = 0;
+		for (unsigned long int Q = M; Q > 1; Q >>= 1)
+			if (x[DIM-1] & Q) t ^= Q-1;
+		for (unsigned int d=0; d < DIM; ++d)
+			x[d] ^= t;
+
+		base::interleave(x, k);
+	}
+};
+#endif
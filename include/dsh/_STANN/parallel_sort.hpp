@@ -0,0 +1,119 @@
+/*****************************************************************************/
+/*                                                                           */
+/*  Header: parallel_sort.hpp                                                */
+/*                                                                           */
+/*  Accompanies STANN Version 0.70 B                                         */
+/*                                                                           */
+/*  (added by Shreos Roychowdhury)                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SFCNN_PARALLEL_SORT__
+#define __SFCNN_PARALLEL_SORT__
+
+#include <vector>
+#include <algorithm>
+#include <boost/thread.hpp>
+
+/*! \file parallel_sort.hpp
+\brief Multi-threaded sort used when building the sfcdata_work index */
+
+using namespace std;
+
+/*! \brief Sorts one run of a parallel_sort on its own thread */
+template<typename Iter, typename Less>
+class parallel_sort_run {
+public:
+	parallel_sort_run(Iter first, Iter last, Less cmp) : first_(first), last_(last), cmp_(cmp) {}
+	void operator()() {
+		std::sort(first_, last_, cmp_);
+	}
+private:
+	Iter first_, last_;
+	Less cmp_;
+};
+
+/*! \brief Merges two adjacent sorted runs of a parallel_sort on its own thread */
+template<typename Iter, typename Less>
+class parallel_merge_run {
+public:
+	parallel_merge_run(Iter first, Iter middle, Iter last, Iter out, Less cmp) :
+		first_(first), middle_(middle), last_(last), out_(out), cmp_(cmp) {}
+	void operator()() {
+		std::merge(first_, middle_, middle_, last_, out_, cmp_);
+	}
+private:
+	Iter first_, middle_, last_, out_;
+	Less cmp_;
+};
+
+//! Threads of a parallel sort
+/*!
+  Number of threads parallel_sort runs on for n elements, 1 if it sorts
+  on the calling thread.
+  \param n Number of elements
+  \param threads Number of threads asked for
+*/
+inline unsigned int parallel_sort_threads(std::size_t n, unsigned int threads)
+{
+	// below this many elements per thread the thread startup dominates
+	const std::size_t min_run = 4096;
+	if (threads > n/min_run) threads = n/min_run;
+	return (threads > 1) ? threads : 1;
+}
+
+//! Parallel sort
+/*!
+  Splits the vector into one run per thread, sorts the runs concurrently
+  and merges adjacent runs pairwise, each round of merges again running
+  concurrently.  The comparator must be a strict total order on the
+  elements, so that the result does not depend on the number of threads.
+  \param A Vector to sort
+  \param cmp Less than comparator
+  \param threads Number of threads to use, 1 sorts on the calling thread
+*/
+template<typename T, typename Less>
+void parallel_sort(vector<T> &A, Less cmp, unsigned int threads)
+{
+	typedef typename vector<T>::iterator Iter;
+	const std::size_t N = A.size();
+
+	threads = parallel_sort_threads(N, threads);
+	if (threads <= 1) {
+		std::sort(A.begin(), A.end(), cmp);
+		return;
+	}
+
+	vector<std::size_t> bounds(threads+1);
+	for (unsigned int i=0; i <= threads; ++i)
+		bounds[i] = (N/threads)*i + ((N%threads)*i)/threads;
+
+	{
+		boost::thread_group group;
+		for (unsigned int i=0; i < threads; ++i)
+			group.create_thread(parallel_sort_run<Iter, Less>(A.begin()+bounds[i], A.begin()+bounds[i+1], cmp));
+		group.join_all();
+	}
+
+	vector<T> B(N);
+	while (bounds.size() > 2) {
+		vector<std::size_t> merged;
+		boost::thread_group group;
+		std::size_t i = 0;
+		for (; i+2 < bounds.size(); i+=2) {
+			group.create_thread(parallel_merge_run<Iter, Less>(A.begin()+bounds[i], A.begin()+bounds[i+1],
+			                    A.begin()+bounds[i+2], B.begin()+bounds[i], cmp));
+			merged.push_back(bounds[i]);
+		}
+		if (i+2 == bounds.size()) {
+			// odd run out, carried over to the next round as is
+			std::copy(A.begin()+bounds[i], A.begin()+bounds[i+1], B.begin()+bounds[i]);
+			merged.push_back(bounds[i]);
+		}
+		merged.push_back(N);
+		group.join_all();
+		A.swap(B);
+		bounds.swap(merged);
+	}
+}
+#endif
@@ -17,8 +17,10 @@
 #ifndef __QKNN_INT__
 #define __QKNN_INT__
 #include <vector>
-#include <queue>
 #include <algorithm>
+#include <limits>
+#include <boost/thread/tss.hpp>
+#include "sfc_options.hpp"
 using namespace std;
 
 /*! \file qknn.hpp
@@ -47,19 +49,86 @@ public:
 
 //! Distance Priority Queue
 /*!
-  Implements a priority queue for pairs of floating point
-  distances and array indexes.  The priority queue is ordered
-  based on the squared distance stored in the first element
-  of the pair.
+  Keeps the K smallest pairs of floating point distances and array
+  indexes seen so far, ordered on the squared distance stored in the
+  first element of the pair.  Up to small_k elements are kept in a
+  sorted array inside the object; larger K use a bounded max heap in a
+  buffer that is kept per thread and reused by later queries, so a
+  search does not allocate once its thread has warmed up.  The largest
+  distance is cached, so topdist() does not touch the elements.  With
+  a filter only the points it accepts are kept.
 */
 
 class qknn {
 private:
-	long unsigned int K;
 	typedef pair<double, long int> q_intelement;
-	typedef priority_queue<q_intelement, vector<q_intelement>, q_intelementCompare>
-	PQ;
-	PQ pq;
+	static const long unsigned int small_k = 16;
+
+	/*! Heap storage reused by the qknn objects of one thread */
+	struct qknn_buffer {
+		qknn_buffer() : in_use(false) {}
+		vector<q_intelement> v;
+		bool in_use;
+	};
+
+	static qknn_buffer* local_buffer() {
+		static boost::thread_specific_ptr<qknn_buffer> tls;
+		if (tls.get() == 0) tls.reset(new qknn_buffer());
+		return tls.get();
+	}
+
+	long unsigned int K;
+	long unsigned int n;
+	double top_;
+	double limit_; // distances above this are not kept
+	const sfc_filter *filter_; // points it rejects are not kept, if set
+	q_intelement small_[small_k];
+	q_intelement *elems_;
+	qknn_buffer *buf_; // thread buffer held by this queue, if any
+	vector<q_intelement> own_; // used when the thread buffer is held by another queue
+
+	qknn(const qknn&);
+	qknn& operator=(const qknn&);
+
+	void release() {
+		if (buf_) buf_->in_use = false;
+		buf_ = 0;
+	}
+
+	bool is_small() const {
+		return K <= small_k;
+	}
+
+	/* insert into the sorted array, dropping the last element if full */
+	void sorted_insert(double dist, long int p) {
+		long unsigned int i = (n < K) ? n++ : n-1;
+		while ((i > 0) && (elems_[i-1].first > dist)) {
+			elems_[i] = elems_[i-1];
+			--i;
+		}
+		elems_[i] = q_intelement(dist, p);
+		top_ = elems_[n-1].first;
+	}
+
+	/* replace the largest element of the full heap and restore it */
+	void heap_replace_top(double dist, long int p) {
+		long unsigned int i = 0;
+		for (;;) {
+			long unsigned int c = 2*i+1;
+			if (c >= n) break;
+			if ((c+1 < n) && (elems_[c].first < elems_[c+1].first)) ++c;
+			if (!(dist < elems_[c].first)) break;
+			elems_[i] = elems_[c];
+			i = c;
+		}
+		elems_[i] = q_intelement(dist, p);
+		top_ = elems_[0].first;
+	}
+
+	/* order the elements by increasing distance */
+	void sort_elements() {
+		if (!is_small()) std::sort_heap(elems_, elems_+n, q_intelementCompare());
+	}
 
 public:
 
@@ -67,25 +136,53 @@ public:
 	/*!
 	  Creates an empty priority  queue.
 	 */
-	qknn() {};
+	qknn() : K(0), n(0), top_(0), limit_((std::numeric_limits<double>::max)()), filter_(0), elems_(small_), buf_(0) {};
+
+	//! Destructor
+	/*!
+	  Gives the thread buffer back for the next queue of this thread.
+	 */
+	~qknn() {
+		release();
+	}
 
 	//! Largest distance
 	/*!
-	  Returns the largest distance value stored in the priority queue
+	  Returns the largest distance value stored in the priority queue, or
+	  the distance limit while the queue is not yet full
 	  \return Largest distance value
 	*/
 	double topdist(void) {
-		return pq.top().first;
+		return (n < K) ? limit_ : top_;
 	}
 
 	//! Set Size
 	/*!
-	  Sets the size of the priority queue.  This should be set before the
-	  queue is used
+	  Sets the size of the priority queue and empties it.  This should be
+	  set before the queue is used
 	  \param k The maximum number of elements to be stored in the queue.
+	  \param limit Largest distance to be stored, default no limit
+	  \param filter Only points it accepts are stored, default all
 	*/
-	void set_size(long unsigned int k) {
+	void set_size(long unsigned int k, double limit = (std::numeric_limits<double>::max)(), const sfc_filter *filter = 0) {
+		release();
 		K = k;
+		n = 0;
+		top_ = 0;
+		limit_ = limit;
+		filter_ = filter;
+		if (is_small()) {
+			elems_ = small_;
+			return;
+		}
+		qknn_buffer *b = local_buffer();
+		vector<q_intelement> &v = b->in_use ? own_ : b->v;
+		if (!b->in_use) {
+			b->in_use = true;
+			buf_ = b;
+		}
+		if (v.size() < K) v.resize(K);
+		elems_ = &v[0];
 	}
 
 	//! Point with largest distance
@@ -94,7 +191,7 @@ public:
 	  \return Index of largest (most distant) element
 	*/
 	long int top() {
-		return pq.top().second;
+		return is_small() ? elems_[n-1].second : elems_[0].second;
 	}
 
 	//! Update queue
@@ -105,52 +202,55 @@ public:
 	  \return True if a point was added to the queue
 	*/
 	bool update(double dist, long int p) {
-		if (size() < K) {
-			q_intelement tq(dist, p);
-			pq.push(tq);
-			return true;
-		} else if (topdist() > dist) {
-			pq.pop();
-			q_intelement tq(dist, p);
-			pq.push(tq);
+		if (dist > limit_) return false;
+		if ((n >= K) && !(top_ > dist)) return false;
+		if (filter_ && !filter_->accept(p)) return false;
+		if (n < K) {
+			if (is_small()) {
+				sorted_insert(dist, p);
+			} else {
+				elems_[n++] = q_intelement(dist, p);
+				std::push_heap(elems_, elems_+n, q_intelementCompare());
+				top_ = elems_[0].first;
+			}
 			return true;
 		}
-		return false;
+		if (is_small())
+			sorted_insert(dist, p);
+		else
+			heap_replace_top(dist, p);
+		return true;
 	}
 
 	//! Create answer
 	/*!
-	  Transforms the queue into a vector of indeces to points and returns it
+	  Transforms the queue into a vector of indeces to points and returns it.
+	  The queue is empty afterwards.
 	  \param pl Vector which will hold the answer after function completes
 	*/
 	void answer(vector<long unsigned int>& pl) {
-		vector<long unsigned int>::size_type i;
-		pl.resize(K);
-		i=pl.size();
-		do {
-			--i;
-			pl[i] = pq.top().second;
-			pq.pop();
-		} while (i != 0);
+		sort_elements();
+		pl.resize(n);
+		for (long unsigned int i=0; i < n; ++i)
+			pl[i] = elems_[i].second;
+		n = 0;
 	};
 	//! Create answer
 	/*!
 	  Transforms the queue into a vector of indeces to points and a
-	  vector of squared distances
+	  vector of squared distances.  The queue is empty afterwards.
 	  \param pl Vector which holds the point indeces after function completes
 	  \param pd Vector which holds the squared distances from query point
 	*/
 	void answer(vector<long unsigned int>& pl, vector<double> &pd) {
-		pl.resize(K);
-		pd.resize(K);
-		vector<long unsigned int>::size_type i;
-		i = pl.size();
-		do {
-			--i;
-			pl[i] = pq.top().second;
-			pd[i] = pq.top().first;
-			pq.pop();
-		} while (i != 0);
+		sort_elements();
+		pl.resize(n);
+		pd.resize(n);
+		for (long unsigned int i=0; i < n; ++i) {
+			pl[i] = elems_[i].second;
+			pd[i] = elems_[i].first;
+		}
+		n = 0;
 	}
 	//! Size function
 	/*!
@@ -158,7 +258,7 @@ public:
 	  \return Size
 	*/
 	long unsigned int size() {
-		return pq.size();
+		return n;
 	}
 };
 
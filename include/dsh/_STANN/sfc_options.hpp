@@ -0,0 +1,136 @@
+/*****************************************************************************/
+/*                                                                           */
+/*  Header: sfc_options.hpp                                                  */
+/*                                                                           */
+/*  Accompanies STANN Version 0.70 B                                         */
+/*                                                                           */
+/*  (added by Shreos Roychowdhury)                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SFC_OPTIONS__
+#define __SFC_OPTIONS__
+
+/*! \file sfc_options.hpp
+\brief Per index build and search options for the sfcdata_work class */
+
+/*! \brief Work budget of one nearest neighbor search.
+
+  A search stops early once it has computed max_visit distances or run
+  for max_usec microseconds and returns the best neighbors found so far.
+  Zero means no limit.  The search reports back the distances it
+  computed and whether it ran to the end, in which case the answer is
+  exact.
+*/
+struct sfc_budget {
+	sfc_budget(long unsigned int v=0, long unsigned int t=0) :
+		max_visit(v),
+		max_usec(t),
+		visited(0),
+		exact(true)
+	{}
+
+	/*! Limit on distances computed, the initial scan of 2k+1 points is
+	    always done */
+	long unsigned int max_visit;
+
+	/*! Limit on the search time in microseconds */
+	long unsigned int max_usec;
+
+	/*! Set by the search, distances computed */
+	long unsigned int visited;
+
+	/*! Set by the search, false if it stopped on the budget */
+	bool exact;
+};
+
+/*! \brief Filter on the points a nearest neighbor search returns.
+
+  A search only keeps the points accept() is true for, so it returns
+  the k nearest points that pass, fewer only if fewer pass.  accept()
+  is called with the index the search would return for the point, and
+  only for points near enough to be kept, so it may do some work.
+*/
+struct sfc_filter {
+	virtual ~sfc_filter() {}
+	virtual bool accept(long unsigned int idx) const =0;
+};
+
+/*! \brief Options controlling how an sfcdata_work index is built and searched.
+
+  The defaults reproduce the original STANN behaviour.
+*/
+struct sfc_options {
+	/*! Space filling curve the points are ordered on */
+	enum curve_type {
+		morton,
+		hilbert
+	};
+
+	sfc_options() :
+		keys(false),
+		threads(1),
+		curve(morton),
+		leaf(4),
+		prefix(0),
+		hot(0),
+		boxes(0),
+		quantize(false),
+		permute(false)
+	{}
+
+	/*! Precompute interleaved z-order keys, radix sort them and search on
+	    the keys instead of the comparator.  Integral, float and double
+	    coordinates; float and double ones are then ordered on their bits,
+	    exactly, instead of on the seperated float comparator. */
+	bool keys;
+
+	/*! Number of threads used to sort the points when building the index.
+	    The index is the same for any number of threads. */
+	unsigned int threads;
+
+	/*! Curve to order the points on. A Hilbert ordering is built on
+	    precomputed keys, so it is only available for the coordinates keys
+	    are, and falls back to z-order otherwise. */
+	curve_type curve;
+
+	/*! Searches compute distances point by point below this many points
+	    of the sorted array, as one block, and split larger ranges at their
+	    middle point.  At most 64. */
+	unsigned int leaf;
+
+	/*! Bits of the key indexed by a lookup table that narrows the search
+	    for the position of a query to the points sharing those bits.  The
+	    bits are those after the leading bits all points have in common.
+	    At most 20, fewer on small indexes, 0 for no table.  Integral
+	    coordinates, and float and double ones built on keys. */
+	unsigned int prefix;
+
+	/*! Levels of the implicit search tree whose nodes are copied, breadth
+	    first, into a separate array read by nearest neighbor searches.
+	    At most 16, fewer on small indexes, 0 for none. */
+	unsigned int hot;
+
+	/*! Points per block of the sorted array whose bounding box is kept
+	    to prune nearest neighbor and radius searches, rounded down to a
+	    power of two from 16 to 4096, 0 for none. */
+	unsigned int boxes;
+
+	/*! Store integral coordinates as 32 bit offsets from a corner near
+	    the bounding box of the points, and the original index of each
+	    point in 32 bits, when the box is under 2^32 wide on every axis
+	    and there are fewer than 2^32 points.  Searches and distances are
+	    the same, the index takes about half the memory. */
+	bool quantize;
+
+	/*! Renumber the points by their position on the curve once the
+	    index is built, so that searches return positions, the original
+	    index of each point is not kept, and the caller can store what it
+	    keeps per point in the same order. */
+	bool permute;
+
+	/*! Default budget of nearest neighbor searches on this index, used
+	    when a query does not give its own */
+	sfc_budget budget;
+};
+#endif
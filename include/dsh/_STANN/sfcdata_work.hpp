@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include <cmath>
 #include <climits>
+#include <limits>
 #include <vector>
 #include <queue>
 #include <algorithm>
@@ -30,7 +31,20 @@
 #include "pair_iter.hpp"
 #include "qknn.hpp"
 #include "zorder_lt.hpp"
+#include "zorder_key.hpp"
+#include "hilbert_key.hpp"
+#include "sqr_dist_block.hpp"
 #include "bsearch.hpp"
+#include "sfc_options.hpp"
+#include "parallel_sort.hpp"
+#include <boost/type_traits/is_same.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#ifdef __GNUC__
+#define SFCNN_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define SFCNN_PREFETCH(p)
+#endif
 
 /*!
 	\mainpage STANN Doxygen Index Page
@@ -62,17 +76,18 @@
   calculated based on that curve. The algorithm has a runtime of   O(ln(N)),
   a construction time of O(Nlog(N)), and a space requirement of
   O(N). The query functions of the algorithm are thread-safe.
+  Id is the type the original index of each point is kept in, an
+  unsigned int halves that memory on indexes of fewer than 2^32 points.
 */
-template <typename Point, typename Ptype=typename Point::__NumType>
+template <typename Point, typename Ptype=typename Point::__NumType, typename Id=long unsigned int>
 class sfcdata_work {
 public:
-	sfcdata_work() {};
+	sfcdata_work() : use_keys(false), use_hilbert(false), build_threads(1), leaf_size(4), block_exact(true),
+		prefix_wanted(0), prefix_from(0), prefix_bits(0), hot_wanted(0), box_shift(0) {};
 	~sfcdata_work() {};
 	void ksearch(Point q, unsigned int k, std::vector<long unsigned int> &nn_idx, float Eps) {
-		long unsigned int query_point_index;
 		qknn que;
-		query_point_index = BinarySearch(points, q, lt);
-		ksearch_common(q, k, query_point_index, que, Eps);
+		ksearch_common(q, k, -1, que, Eps);
 		que.answer(nn_idx);
 	}
 
@@ -86,21 +101,168 @@ public:
 	  \param nn_idx Answer vector
 	  \param dist Distance Vector
 	  \param eps Error tolerence, default of 0.0.
+	  \param budget Optional work budget, also returns the work done
+	  \param filter Optional filter, only points it accepts are returned
 	*/
-	void ksearch(Point q, unsigned int k, std::vector<long unsigned int> &nn_idx, std::vector<double> &dist, float Eps) {
-		long unsigned int query_point_index;
+	void ksearch(Point q, unsigned int k, std::vector<long unsigned int> &nn_idx, std::vector<double> &dist, float Eps,
+	             sfc_budget *budget=0, const sfc_filter *filter=0) {
 		qknn que;
-		query_point_index = BinarySearch(points, q, lt);
-		ksearch_common(q, k, query_point_index, que, Eps);
+		ksearch_common(q, k, -1, que, Eps, -1, budget, filter);
 		que.answer(nn_idx, dist);
 	}
+
+	/*!
+	  \brief Batch Nearest Neighbor search function
+	  Searches for the k nearest neighbors of every point in qs.  The
+	  queries are visited in z-order so that each binary search gallops
+	  from the position of the previous one, and the k-th distance of the
+	  previous answer (plus the distance moved) bounds the initial search
+	  box of the next query.  Answers are returned in the input order.
+	  This function is thread-safe.
+	  \param qs The query points
+	  \param k The number of neighbors to return per query
+	  \param nn_idx Answer vectors, one per query
+	  \param dist Distance Vectors, one per query
+	  \param eps Error tolerence, default of 0.0.
+	*/
+	void ksearch_batch(std::vector<Point> &qs, unsigned int k, std::vector<std::vector<long unsigned int> > &nn_idx, std::vector<std::vector<double> > &dist, float Eps) {
+		std::size_t m = qs.size();
+		nn_idx.resize(m);
+		dist.resize(m);
+		if (m==0) return;
+
+		std::vector<long unsigned int> order(m);
+		for (std::size_t i=0; i < m; ++i) order[i] = i;
+		std::sort(order.begin(), order.end(), batch_lt(qs, lt));
+
+		qknn que;
+		long int query_point_index = -1;
+		double bound_sq = -1;
+		for (std::size_t i=0; i < m; ++i) {
+			Point &q = qs[order[i]];
+			if (i > 0) {
+				double r = sqrt(bound_sq) + sqrt(q.sqr_dist(qs[order[i-1]]));
+				// rounded up a little, so that it is never below the distance
+				bound_sq = r*r*(1+1e-12);
+			}
+			query_point_index = ksearch_common(q, k, query_point_index, que, Eps, (i > 0) ? bound_sq : -1);
+			bound_sq = que.topdist();
+			que.answer(nn_idx[order[i]], dist[order[i]]);
+		}
+	}
+	/*!
+	  \brief Radius search function
+	  Searches for the points within distance r of the point q, nearest
+	  first.  With a limit only the nearest limit points are returned,
+	  kept in a queue of that size whose farthest point shrinks the
+	  radius of the rest of the search once it is full.
+	  This function is thread-safe.
+	  \param q The query point
+	  \param r The search radius
+	  \param limit Maximum number of points to return, 0 for all
+	  \param nn_idx Answer vector
+	  \param dist Distance Vector
+	  \param filter Optional filter, only points it accepts are returned
+	*/
+	void rsearch(Point q, double r, long unsigned int limit, std::vector<long unsigned int> &nn_idx, std::vector<double> &dist,
+	             const sfc_filter *filter=0) {
+		double r_sq = r*r;
+		query_state st;
+		st.q = q;
+		st.block = block_exact && sqr_dist_block<Point>::exact(q);
+		compute_bounding_box(st, r);
+		if (limit > 0) {
+			if (limit > points.size()) limit = points.size();
+			qknn que;
+			que.set_size(limit, r_sq, filter);
+			rrecurse(0, points.size(), r_sq, que, st);
+			que.answer(nn_idx, dist);
+			return;
+		}
+		std::vector<std::pair<double, long unsigned int> > found;
+		rrecurse(0, points.size(), r_sq, found, st);
+		if (filter) {
+			std::size_t n = 0;
+			for (std::size_t i=0; i < found.size(); ++i)
+				if (filter->accept(found[i].second)) found[n++] = found[i];
+			found.resize(n);
+		}
+		std::sort(found.begin(), found.end());
+		nn_idx.resize(found.size());
+		dist.resize(found.size());
+		for (std::size_t i=0; i < found.size(); ++i) {
+			nn_idx[i] = found[i].second;
+			dist[i] = found[i].first;
+		}
+	}
+
+	/*!
+	  \brief Window search function
+	  Visits the points inside the axis aligned box [lower, upper], in
+	  z-order.  The sorted array is split into contiguous z-order ranges:
+	  ranges whose quadtree box lies inside the window are visited without
+	  any test, ranges whose box misses it are skipped, and the rest are
+	  split at their middle point.  visit(idx) is called with the index of
+	  each point and returns false to stop the search.
+	  This function is thread-safe.
+	  \param lower The lower corner of the window
+	  \param upper The upper corner of the window
+	  \param visit Visitor, called as bool visit(long unsigned int)
+	  \return false if the visitor stopped the search
+	*/
+	template <typename Visitor>
+	bool wsearch(Point lower, Point upper, Visitor &visit) {
+		query_state st;
+		st.lower = lower;
+		st.upper = upper;
+		return wrecurse(0, points.size(), st, visit);
+	}
+	/*!
+	  \brief Window search by position
+	  As wsearch, but visit(i) is called with the position i of each point
+	  in the sorted array, whose point is point(i) and index pointer(i).
+	*/
+	template <typename Visitor>
+	bool wsearch_sorted(Point lower, Point upper, Visitor &visit) {
+		query_state st;
+		st.lower = lower;
+		st.upper = upper;
+		st.sorted = true;
+		return wrecurse(0, points.size(), st, visit);
+	}
+
+	/*! Number of points */
+	std::size_t size() const {
+		return points.size();
+	}
+	/*! Point i of the sorted array */
+	const Point &point(std::size_t i) const {
+		return points[i];
+	}
+	/*! Original index of point i of the sorted array, i once renumbered */
+	long unsigned int pointer(std::size_t i) const {
+		return id_at(i);
+	}
+
+	/*!
+	  \brief Renumber the points by their position in the sorted array
+	  Searches then return the position of each point instead of its
+	  original index, and the original indexes are no longer kept.
+	  \param order Set to the original index of each position
+	*/
+	void renumber(std::vector<long unsigned int> &order) {
+		order.assign(pointers.begin(), pointers.end());
+		lVec().swap(pointers);
+		init_hot();
+	}
+
 	/*!
 	  \brief Initialize the sfc data structure
 	  \param PointAr Array of Pints to use
 	  \return bool status
 	*/
 	template <typename ArrT>
-	bool sfcnn_do_init(ArrT& PointArr) {
+	bool sfcnn_do_init(ArrT& PointArr, const sfc_options &opts = sfc_options()) {
 		std::size_t N = PointArr.size();
 		if (N==0) return false; // logic change  do it
 		std::size_t Dim = PointArr[0].size();
@@ -112,44 +274,590 @@ public:
 				points[i][j] = PointArr[i][j];
 			}
 		}
+		use_hilbert = (opts.curve == sfc_options::hilbert) && hilbert_key<Point>::valid;
+		use_keys = (opts.keys || use_hilbert) && zorder_key<Point>::valid;
+		lt.set_ordered(use_keys);
+		build_threads = (opts.threads > 0) ? opts.threads : 1;
+		leaf_size = (opts.leaf < 2) ? 2 : ((opts.leaf > max_leaf) ? max_leaf : opts.leaf);
+		prefix_wanted = (opts.prefix > max_prefix) ? max_prefix : opts.prefix;
+		hot_wanted = (opts.hot > max_hot) ? max_hot : opts.hot;
+		box_shift = 0;
+		if (opts.boxes >= min_box) {
+			while ((box_shift < max_box_shift) && ((2U << box_shift) <= opts.boxes)) ++box_shift;
+		}
+		block_exact = true;
+		for (std::size_t i=0; (i < N) && block_exact; ++i)
+			block_exact = sqr_dist_block<Point>::exact(points[i]);
 		return sfcdata_work_init();
 	}
 
 private:
 	typedef std::vector<Point> pVec;
 	pVec points;
-	typedef std::vector<long unsigned int> lVec;
-	lVec pointers;
+	typedef std::vector<Id> lVec;
+	lVec pointers; // empty once renumbered
+	/*! Index returned for point i of the sorted array */
+	long unsigned int id_at(std::size_t i) const {
+		return pointers.empty() ? i : pointers[i];
+	}
+	typedef typename zorder_key<Point>::key_type key_type;
+	std::vector<key_type> keys;
+	bool use_keys;
+	bool use_hilbert; // keys are Hilbert keys, implies use_keys
+	/* cells per dimension covering a search box on the Hilbert curve */
+	static const unsigned int hilbert_split = (Point::__DIM <= 3) ? 3 : 2;
+	static const unsigned int hilbert_ranges = (Point::__DIM <= 3) ? 27 : (1U << Point::__DIM);
+	unsigned int build_threads;
+	static const unsigned int max_leaf = 64;
+	unsigned int leaf_size; // ranges below this are leaves
+	bool block_exact; // block distances to the points equal sqr_dist
+	static const unsigned int max_prefix = 20;
+	unsigned int prefix_wanted;
+	/* points with bits prefix_from .. prefix_from+prefix_bits-1 of their
+	   key equal to c are prefix_table[c] .. prefix_table[c+1]-1, all
+	   points share the bits before prefix_from with prefix_first */
+	std::vector<long unsigned int> prefix_table;
+	unsigned int prefix_from, prefix_bits;
+	key_type prefix_first, prefix_last;
+	/*
+	  Copy of an internal node of the implicit tree, the range s, n with
+	  its middle point m = s+n/2.  The nodes of the top levels are stored
+	  breadth first from index 1, node i having the children 2i and 2i+1,
+	  so the first levels of every search read one small array instead of
+	  points spread over the whole index.
+	*/
+	struct hot_node {
+		Point mid, first, last; // points m, s and s+n-1
+		Id pointer; // pointers[m]
+	};
+	struct hot_key {
+		key_type mid, first, last; // keys of m, s and s+n-1
+	};
+	static const unsigned int max_hot = 16;
+	unsigned int hot_wanted;
+	std::vector<hot_node> hot; // empty, or 2^levels nodes
+	std::vector<hot_key> hot_keys; // with use_keys only
+	static const unsigned int min_box = 16;
+	static const unsigned int max_box_shift = 12;
+	/* blocks of 2^box_shift points of the sorted array and the bounding
+	   box of each, none if box_shift is 0 */
+	unsigned int box_shift;
+	pVec box_lo, box_hi;
+	static const bool int_coords = boost::is_same<typename zorder_traits<Ptype>::is_integral, zorder_t>::value;
 	zorder_lt<Point> lt;
 	float eps;
 	typename Point::__NumType max, min;
 
-	void compute_bounding_box(Point q, Point &q1, Point &q2, double R) {
-		cbb_work<Point, Ptype>::eval(q, q1, q2, R, max, min);
+	/*!
+	  \brief Orders indexes of a query vector by the z-order of the queries
+	*/
+	class batch_lt {
+	public:
+		batch_lt(pVec &qs, zorder_lt<Point> &lt) : qs_(qs), lt_(lt) {}
+		bool operator()(long unsigned int a, long unsigned int b) {
+			return lt_(qs_[a], qs_[b]);
+		}
+	private:
+		pVec &qs_;
+		zorder_lt<Point> &lt_;
+	};
+
+	/*!
+	  \brief Point and original index, the unit of the build sort
+	*/
+	struct sort_entry {
+		sort_entry() : p(), id(0) {}
+		Point p;
+		Id id;
+	};
+
+	/*!
+	  \brief Orders sort entries by z-order, then by original index
+	  The index breaks ties between equal points, so the sort is a total
+	  order and its result does not depend on the number of threads.
+	*/
+	class sort_entry_lt {
+	public:
+		sort_entry_lt(zorder_lt<Point> &lt) : lt_(lt) {}
+		bool operator()(const sort_entry &a, const sort_entry &b) {
+			if (lt_(a.p, b.p)) return true;
+			if (lt_(b.p, a.p)) return false;
+			return a.id < b.id;
+		}
+	private:
+		zorder_lt<Point> &lt_;
+	};
+
+	/*!
+	  \brief Orders the pairs of pair_iter as sort_entry_lt orders entries
+	  The single threaded build sorts points and pointers in place, with
+	  the same order as the threaded one.
+	*/
+	class pair_entry_lt {
+	public:
+		typedef Mypair<typename pVec::iterator, typename lVec::iterator> pair_type;
+		pair_entry_lt(zorder_lt<Point> &lt) : lt_(lt) {}
+		bool operator()(const pair_type &a, const pair_type &b) {
+			if (lt_(a.val1, b.val1)) return true;
+			if (lt_(b.val1, a.val1)) return false;
+			return a.val2 < b.val2;
+		}
+	private:
+		zorder_lt<Point> &lt_;
+	};
+
+	/*!
+	  \brief Key and original index, the unit of the keyed build sort
+	*/
+	struct key_entry {
+		key_type key;
+		Id id;
+	};
+
+	/*!
+	  \brief Orders key entries by key, then by original index
+	*/
+	class key_entry_lt {
+	public:
+		bool operator()(const key_entry &a, const key_entry &b) const {
+			if (zorder_key<Point>::less(a.key, b.key)) return true;
+			if (zorder_key<Point>::less(b.key, a.key)) return false;
+			return a.id < b.id;
+		}
+	};
+
+	/*!
+	  \brief Makes the key entries of a range of points on its own thread
+	*/
+	class key_entry_maker {
+	public:
+		key_entry_maker(const sfcdata_work &w, const pVec &pts, std::vector<key_entry> &out, std::size_t lo, std::size_t hi) :
+			w_(w), pts_(pts), out_(out), lo_(lo), hi_(hi) {}
+		void operator()() {
+			for (std::size_t i=lo_; i < hi_; ++i) {
+				w_.make_key(pts_[i], out_[i].key);
+				out_[i].id = i;
+			}
+		}
+	private:
+		const sfcdata_work &w_;
+		const pVec &pts_;
+		std::vector<key_entry> &out_;
+		std::size_t lo_, hi_;
+	};
+
+	/*!
+	  \brief Per query search state
+	  The bounding box of the current k-th distance and, in key mode, the
+	  keys of the query and of the box corners.
+	*/
+	struct query_state {
+		query_state() : box_keyed(false), ranges(0), range_level(0), bound_sq((std::numeric_limits<double>::max)()),
+			visited(0), max_visit(0), timed(false), stopped(false), block(false), sorted(false) {}
+		Point q;
+		key_type qkey;
+		Point lower, upper;
+		key_type lower_key, upper_key;
+		bool box_keyed; // lower_key and upper_key are current
+		key_type range_lo[hilbert_ranges], range_hi[hilbert_ranges]; // Hilbert key ranges of the box
+		unsigned int ranges, range_level;
+		long unsigned int scan_lo, scan_hi; // initial scan range, already queued
+		double bound_sq; // known bound on the squared k-th distance, max if none
+		long unsigned int visited; // points whose distance was computed
+		long unsigned int max_visit; // budget on visited, 0 for none
+		bool timed; // deadline is set
+		bool stopped; // budget ran out
+		boost::posix_time::ptime deadline;
+		bool block; // leaves use sqr_dist_block
+		bool sorted; // a window search visits positions, not indexes
+	};
+
+	/*! Squared distance the k-th neighbour lies within, the smaller of the
+	  queue's and the known bound */
+	double reach(qknn &ans, const query_state &st) {
+		const double d = ans.topdist();
+		return (st.bound_sq < d) ? st.bound_sq : d;
+	}
+
+	/*! Count a computed distance against the budget, true once it ran out.
+	  The clock is only read every 16 distances. */
+	bool spend(query_state &st) {
+		++st.visited;
+		if (st.max_visit && (st.visited >= st.max_visit))
+			st.stopped = true;
+		else if (st.timed && ((st.visited & 15) == 0)
+		         && (boost::posix_time::microsec_clock::universal_time() >= st.deadline))
+			st.stopped = true;
+		return st.stopped;
+	}
+
+	/*! Make the key of p on the curve of this index */
+	void make_key(const Point &p, key_type &k) const {
+		if (use_hilbert) hilbert_key<Point>::make(p, k);
+		else zorder_key<Point>::make(p, k);
+	}
+
+	void compute_bounding_box(query_state &st, double R) {
+		cbb_work<Point, Ptype>::eval(st.q, st.lower, st.upper, R, max, min);
+		st.box_keyed = false;
+	}
+	/*! Make the box corner keys if the box changed since they were made */
+	void key_bounding_box(query_state &st) {
+		if (st.box_keyed) return;
+		if (use_hilbert) {
+			hilbert_bounding_box(st);
+		} else {
+			zorder_key<Point>::make(st.lower, st.lower_key);
+			zorder_key<Point>::make(st.upper, st.upper_key);
+		}
+		st.box_keyed = true;
+	}
+	/*
+	  On a Hilbert curve the corners of a box are not its first and last
+	  keys.  Instead the box is covered with the cells of the finest level
+	  that needs at most hilbert_split cells per dimension, and each cell
+	  is one key range.  lower_key and upper_key become the first and last
+	  key of these ranges, which every point of the box lies between, as
+	  on the z-order.
+	*/
+	void hilbert_bounding_box(query_state &st) {
+		typedef typename zorder_key<Point>::coord coord;
+		const unsigned int DIM = Point::__DIM;
+		unsigned long int lo[DIM], hi[DIM];
+		unsigned long int extent = 0;
+		for (unsigned int j=0; j < DIM; ++j) {
+			lo[j] = coord::encode(st.lower[j]);
+			hi[j] = coord::encode(st.upper[j]);
+			extent |= hi[j]-lo[j];
+		}
+		// cells of 2^level are wider than the box, so it spans two of them
+		// at most; one level down it spans three at most
+		unsigned int level = 0;
+		for (; extent; extent >>= 1) ++level;
+		if ((hilbert_split > 2) && (level > 0)) --level;
+		// the box only shrinks while searching, so ranges made for an
+		// earlier box of the same level still cover it
+		if ((st.ranges > 0) && (level >= st.range_level)) return;
+
+		const unsigned int bits = level*DIM;
+		unsigned long int cell[DIM], first[DIM], last[DIM];
+		for (unsigned int j=0; j < DIM; ++j) {
+			first[j] = (level < 64) ? (lo[j] >> level) : 0;
+			last[j] = (level < 64) ? (hi[j] >> level) : 0;
+			cell[j] = first[j];
+		}
+		st.ranges = 0;
+		st.range_level = level;
+		for (;;) {
+			unsigned long int x[DIM];
+			for (unsigned int j=0; j < DIM; ++j)
+				x[j] = (level < 64) ? (cell[j] << level) : 0;
+			key_type &rlo = st.range_lo[st.ranges];
+			key_type &rhi = st.range_hi[st.ranges];
+			hilbert_key<Point>::make_encoded(x, rlo);
+			zorder_key<Point>::fill_low(rlo, bits, false);
+			rhi = rlo;
+			zorder_key<Point>::fill_low(rhi, bits, true);
+			if ((st.ranges == 0) || zorder_key<Point>::less(rlo, st.lower_key))
+				st.lower_key = rlo;
+			if ((st.ranges == 0) || zorder_key<Point>::less(st.upper_key, rhi))
+				st.upper_key = rhi;
+			++st.ranges;
+			// next cell, dimension 0 fastest
+			unsigned int j = 0;
+			for (; j < DIM; ++j) {
+				if (cell[j] < last[j]) {
+					++cell[j];
+					break;
+				}
+				cell[j] = first[j];
+			}
+			if (j == DIM) break;
+		}
+	}
+	/*! True if the keys of points s to e miss every Hilbert range of the box */
+	bool outside_ranges(query_state &st, long unsigned int s, long unsigned int e) {
+		if (!use_hilbert) return false;
+		return outside_ranges(st, keys[s], keys[e]);
+	}
+	/*! True if the keys ks to ke miss every Hilbert range of the box */
+	bool outside_ranges(query_state &st, const key_type &ks, const key_type &ke) {
+		if (!use_hilbert) return false;
+		key_bounding_box(st);
+		for (unsigned int r=0; r < st.ranges; ++r) {
+			if (!zorder_key<Point>::less(ke, st.range_lo[r])
+			        && !zorder_key<Point>::less(st.range_hi[r], ks))
+				return false;
+		}
+		return true;
 	}
+	/*! Key of point i, null without keys */
+	const key_type *key_at(long unsigned int i) const {
+		return use_keys ? &keys[i] : 0;
+	}
+	/*! True if the query precedes point i in z-order */
+	bool query_before(query_state &st, long unsigned int i) {
+		return query_before(st, points[i], key_at(i));
+	}
+	/*! True if the query precedes p, with the key k, in z-order */
+	bool query_before(query_state &st, const Point &p, const key_type *k) {
+		if (!use_keys) return lt(st.q, p);
+		return zorder_key<Point>::less(st.qkey, *k);
+	}
+	/*! True if point i precedes the upper box corner in z-order */
+	bool before_upper(query_state &st, long unsigned int i) {
+		return before_upper(st, points[i], key_at(i));
+	}
+	/*! True if p, with the key k, precedes the upper box corner in z-order */
+	bool before_upper(query_state &st, const Point &p, const key_type *k) {
+		if (!use_keys) return lt(p, st.upper);
+		key_bounding_box(st);
+		return zorder_key<Point>::less(*k, st.upper_key);
+	}
+	/*! True if the lower box corner precedes point i in z-order */
+	bool lower_before(query_state &st, long unsigned int i) {
+		return lower_before(st, points[i], key_at(i));
+	}
+	/*! True if the lower box corner precedes p, with the key k, in z-order */
+	bool lower_before(query_state &st, const Point &p, const key_type *k) {
+		if (!use_keys) return lt(st.lower, p);
+		key_bounding_box(st);
+		return zorder_key<Point>::less(st.lower_key, *k);
+	}
+	/*! True if the upper box corner precedes point i in z-order */
+	bool upper_before(query_state &st, long unsigned int i) {
+		if (!use_keys) return lt(st.upper, points[i]);
+		key_bounding_box(st);
+		return zorder_key<Point>::less(st.upper_key, keys[i]);
+	}
+	/*! True if point i precedes the lower box corner in z-order */
+	bool before_lower(query_state &st, long unsigned int i) {
+		if (!use_keys) return lt(points[i], st.lower);
+		key_bounding_box(st);
+		return zorder_key<Point>::less(keys[i], st.lower_key);
+	}
+
 	/*!
 	  \brief Initialize the sfc data structure
 	  \return bool status
 	*/
 	bool sfcdata_work_init() {
-		max = (std::numeric_limits<typename Point::__NumType>::max)();
-		min = (std::numeric_limits<typename Point::__NumType>::min)();
+		typedef std::numeric_limits<typename Point::__NumType> limits;
+		max = (limits::max)();
+		// min() of a floating type is its smallest positive value
+		min = limits::is_integer ? (limits::min)() : -(limits::max)();
 
 		if (points.size() == 0) {
 			return false;
 		}
-		pair_iter<typename pVec::iterator, typename lVec::iterator>
-		a(points.begin(), pointers.begin()),
-		b(points.end(), pointers.end());
-		std::sort(a,b,lt);
+		const bool threaded = (parallel_sort_threads(points.size(), build_threads) > 1);
+		if (use_keys) {
+			if (!threaded) {
+				keys.resize(points.size());
+				for (std::size_t i=0; i < points.size(); ++i)
+					make_key(points[i], keys[i]);
+				zorder_key_sort(keys, points, pointers);
+			} else {
+				sfcdata_work_init_keys();
+			}
+		} else if (!threaded) {
+			pair_iter<typename pVec::iterator, typename lVec::iterator>
+			a(points.begin(), pointers.begin()),
+			b(points.end(), pointers.end());
+			std::sort(a, b, pair_entry_lt(lt));
+		} else {
+			std::size_t N = points.size();
+			std::vector<sort_entry> entries(N);
+			for (std::size_t i=0; i < N; ++i) {
+				entries[i].p = points[i];
+				entries[i].id = pointers[i];
+			}
+			parallel_sort(entries, sort_entry_lt(lt), build_threads);
+			for (std::size_t i=0; i < N; ++i) {
+				points[i] = entries[i].p;
+				pointers[i] = entries[i].id;
+			}
+		}
+		init_prefix_table();
+		init_hot();
+		init_boxes();
 		return true;
 	}
 
-	void ksearch_common(Point q, unsigned int k, long unsigned int query_point_index, qknn &que, float Eps) {
-		Point bound_box_lower_corner, bound_box_upper_corner;
-		Point low, high;
+	/*! Bounding box of each block of 2^box_shift points */
+	void init_boxes() {
+		box_lo.clear();
+		box_hi.clear();
+		if (box_shift == 0) return;
+		const std::size_t N = points.size();
+		const std::size_t nb = ((N-1) >> box_shift) + 1;
+		box_lo.resize(nb);
+		box_hi.resize(nb);
+		for (std::size_t b=0; b < nb; ++b) {
+			Point &lo = box_lo[b];
+			Point &hi = box_hi[b];
+			const std::size_t s = b << box_shift;
+			const std::size_t e = std::min(N, s + (1UL << box_shift));
+			lo = points[s];
+			hi = points[s];
+			for (std::size_t i=s+1; i < e; ++i) {
+				for (unsigned int j=0; j < Point::__DIM; ++j) {
+					if (points[i][j] < lo[j]) lo[j] = points[i][j];
+					if (points[i][j] > hi[j]) hi[j] = points[i][j];
+				}
+			}
+		}
+	}
+
+	/*
+	  Copy the internal nodes of the top hot_wanted levels, fewer if the
+	  tree is not that deep, into the hot array.
+	*/
+	void init_hot() {
+		hot.clear();
+		hot_keys.clear();
+		unsigned int levels = 0;
+		while ((levels < hot_wanted) && ((points.size() >> levels) >= leaf_size)) ++levels;
+		if (levels == 0) return;
+		hot.resize(1UL << levels);
+		if (use_keys) hot_keys.resize(hot.size());
+		init_hot(0, points.size(), 1);
+	}
+	void init_hot(long unsigned int s, long unsigned int n, long unsigned int node) {
+		if ((node >= hot.size()) || (n < leaf_size)) return;
+		const long unsigned int m = s+n/2;
+		hot_node &h = hot[node];
+		h.mid = points[m];
+		h.first = points[s];
+		h.last = points[s+n-1];
+		h.pointer = id_at(m);
+		if (use_keys) {
+			hot_key &k = hot_keys[node];
+			k.mid = keys[m];
+			k.first = keys[s];
+			k.last = keys[s+n-1];
+		}
+		init_hot(s, n/2, 2*node);
+		init_hot(m+1, n-n/2-1, 2*node+1);
+	}
+
+	/*! Key of the sorted point i */
+	void point_key(std::size_t i, key_type &k) const {
+		if (use_keys) k = keys[i];
+		else zorder_key<Point>::make(points[i], k);
+	}
+
+	/*
+	  Build the prefix table on the bits after the common leading bits of
+	  all keys, which are those of the first and the last key.  It has
+	  about one entry per four points, 2^max_prefix+1 entries at most.
+	*/
+	void init_prefix_table() {
+		prefix_table.clear();
+		prefix_bits = 0;
+		if (!zorder_key<Point>::valid || !lt.key_order() || (prefix_wanted == 0)) return;
+		const std::size_t N = points.size();
+		point_key(0, prefix_first);
+		point_key(N-1, prefix_last);
+		prefix_from = zorder_key<Point>::common_bits(prefix_first, prefix_last);
+		unsigned int bits = 0;
+		while ((bits < prefix_wanted) && ((4UL << bits) < N)) ++bits;
+		if (bits > zorder_key<Point>::WORDS*64 - prefix_from)
+			bits = zorder_key<Point>::WORDS*64 - prefix_from;
+		if (bits == 0) return;
+
+		prefix_table.resize((1UL << bits) + 1);
+		long unsigned int c = 0;
+		key_type k;
+		for (std::size_t i=0; i < N; ++i) {
+			point_key(i, k);
+			long unsigned int ci = zorder_key<Point>::bits(k, prefix_from, bits);
+			while (c <= ci) prefix_table[c++] = i;
+		}
+		while (c < prefix_table.size()) prefix_table[c++] = N;
+		prefix_bits = bits;
+	}
+
+	/*
+	  Position of the query in the sorted points, as the index of a point
+	  next to it.  With a prefix table the search covers only the points
+	  sharing the leading key bits of the query.  hint is as for
+	  ksearch_common, a search with one gallops from it instead.
+	*/
+	long int locate(query_state &st, long int hint) {
+		if (use_keys) make_key(st.q, st.qkey);
+		if ((prefix_bits == 0) || (hint >= 0)) {
+			if (use_keys) return KeyGallopSearch(keys, st.qkey, hint);
+			return GallopSearch(points, st.q, lt, hint);
+		}
+		if (!use_keys) zorder_key<Point>::make(st.q, st.qkey);
+		const long int N = points.size();
+		// outside the keys of the points it shares no prefix with them
+		if (zorder_key<Point>::less(st.qkey, prefix_first)) return 0;
+		if (!zorder_key<Point>::less(st.qkey, prefix_last)) return N-1;
+		long unsigned int c = zorder_key<Point>::bits(st.qkey, prefix_from, prefix_bits);
+		long int low = prefix_table[c];
+		long int high = prefix_table[c+1];
+		// the last point before the slice is not greater than the query
+		if (low > 0) --low;
+		if (use_keys) return KeySearch(keys, st.qkey, low, high);
+		return BinarySearch(points, st.q, lt, low, high-1);
+	}
+
+	/*
+	  Keyed build on build_threads threads.  Orders as the radix sort does,
+	  since that is stable and the pointers start out in index order.
+	*/
+	bool sfcdata_work_init_keys() {
+		std::size_t N = points.size();
+		std::vector<key_entry> entries(N);
+		{
+			boost::thread_group group;
+			for (unsigned int t=0; t < build_threads; ++t)
+				group.create_thread(key_entry_maker(*this, points, entries, (N*t)/build_threads, (N*(t+1))/build_threads));
+			group.join_all();
+		}
+		parallel_sort(entries, key_entry_lt(), build_threads);
+		pVec sorted(N);
+		keys.resize(N);
+		for (std::size_t i=0; i < N; ++i) {
+			keys[i] = entries[i].key;
+			sorted[i] = points[entries[i].id];
+			pointers[i] = entries[i].id;
+		}
+		points.swap(sorted);
+		return true;
+	}
+
+	/*
+	  hint is the index returned for a nearby earlier query, or negative.
+	  bound_sq, if not negative, is a known upper bound on the squared
+	  distance to the k-th neighbour and shrinks the initial search box.
+	  budget, if given, limits the work done and returns the number of
+	  points whose distance was computed and whether the search completed.
+	  filter, if given, is passed to the queue, which then keeps only the
+	  points it accepts.
+	  Returns the located index of the query, to be used as a later hint.
+	*/
+	long int ksearch_common(Point q, unsigned int k, long int hint, qknn &que, float Eps, double bound_sq=-1,
+	                        sfc_budget *budget=0, const sfc_filter *filter=0) {
+		query_state st;
+		long int located;
+		long unsigned int query_point_index;
+
+		st.q = q;
+		st.block = block_exact && sqr_dist_block<Point>::exact(q);
+		if (budget) {
+			st.max_visit = budget->max_visit;
+			st.timed = (budget->max_usec > 0);
+			if (st.timed)
+				st.deadline = boost::posix_time::microsec_clock::universal_time()
+				              + boost::posix_time::microseconds(budget->max_usec);
+		}
+		located = locate(st, hint);
+		query_point_index = located;
 
-		que.set_size(k);
+		que.set_size(k, (std::numeric_limits<double>::max)(), filter);
 		eps=(float) 1.0+Eps;
 		if (query_point_index >= (k)) query_point_index -= (k);
 		else query_point_index=0;
@@ -158,60 +866,290 @@ private:
 		if (initial_scan_upper_range > (long unsigned int)points.size())
 			initial_scan_upper_range = (long unsigned int)points.size();
 
-		low = points[query_point_index];
-		high = points[initial_scan_upper_range-1];
 		for (long unsigned int i=query_point_index; i<initial_scan_upper_range; ++i) {
-			que.update(points[i].sqr_dist(q), pointers[i]);
+			que.update(points[i].sqr_dist(q), id_at(i));
 		}
-		compute_bounding_box(q, bound_box_lower_corner, bound_box_upper_corner, sqrt(que.topdist()));
+		if (bound_sq >= 0) st.bound_sq = bound_sq;
+		compute_bounding_box(st, sqrt(reach(que, st)));
+		st.visited = initial_scan_upper_range-query_point_index;
 
-		if (lt(bound_box_upper_corner, high) && lt(low,bound_box_lower_corner)) {
+		if (!(upper_before(st, initial_scan_upper_range-1) && before_lower(st, query_point_index))) {
+			//Recurse through the entire set
+			st.scan_lo = query_point_index;
+			st.scan_hi = initial_scan_upper_range;
+			traverse(que, st);
+		}
+		if (budget) {
+			budget->visited = st.visited;
+			budget->exact = !st.stopped;
+		}
+		return located;
+	}
+
+	/*! Squared distances of the n points from s to the query */
+	void leaf_dist(long unsigned int s, long unsigned int n, query_state &st, double *d) {
+		if (st.block) {
+			sqr_dist_block<Point>::eval(&points[s], n, st.q, d);
 			return;
 		}
+		for (long unsigned int i=0; i < n; ++i)
+			d[i] = points[s+i].sqr_dist(st.q);
+	}
+
+	/*
+	  Squared distance from the query to the box of block b.  It is
+	  summed as dpoint::sqr_dist sums, so it is not greater than the
+	  distance of any point in the block.
+	*/
+	double box_dist(const query_state &st, long unsigned int b) {
+		const Point &lo = box_lo[b];
+		const Point &hi = box_hi[b];
+		double z = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			double d = 0;
+			if (st.q[j] < lo[j]) d = (double) lo[j] - (double) st.q[j];
+			else if (st.q[j] > hi[j]) d = (double) st.q[j] - (double) hi[j];
+			z = d*d + z;
+		}
+		return z;
+	}
 
-		//Recurse through the entire set
-		recurse(0, points.size(), q, que, bound_box_lower_corner, bound_box_upper_corner, query_point_index, initial_scan_upper_range);
+	/*! True if the points s to e lie in at most two blocks, all of
+	  whose boxes are farther from the query than r_sq */
+	bool blocks_beyond(const query_state &st, long unsigned int s, long unsigned int e, double r_sq) {
+		if (box_shift == 0) return false;
+		const long unsigned int b0 = s >> box_shift;
+		const long unsigned int b1 = e >> box_shift;
+		if (b1 > b0+1) return false;
+		return (box_dist(st, b0) > r_sq) && ((b1 == b0) || (box_dist(st, b1) > r_sq));
 	}
 
-	inline void recurse(long unsigned int s,     // Starting index
-	                    long unsigned int n,     // Number of points
-	                    Point q,  // Query point
-	                    qknn &ans, // Answer que
-	                    Point &bound_box_lower_corner,
-	                    Point &bound_box_upper_corner,
-	                    long unsigned int initial_scan_lower_range,
-	                    long unsigned int initial_scan_upper_range) {
-		if (n < 4) {
-			if (n == 0) return;
+	/*
+	  Deferred second half of a range in the kNN traversal, with the test
+	  the recursion made on it after the first half was searched.
+	*/
+	struct trav_entry {
+		long unsigned int s, n; // starting index and number of points
+		long unsigned int m; // middle point of the parent, for the test
+		long unsigned int node; // breadth first number of the half
+		long unsigned int parent; // hot node of the parent, 0 if not hot
+		bool upper; // test before_upper(m) if true, lower_before(m) if not
+	};
+	/* one entry per level of the implicit tree */
+	static const unsigned int trav_depth = sizeof(long unsigned int)*CHAR_BIT;
+
+	/*! Prefetch what the traversal reads first from the range s, n.  Its
+	  end points are next to those of the parent and already cached. */
+	void prefetch_range(long unsigned int s, long unsigned int n) {
+		if (n == 0) return;
+		SFCNN_PREFETCH(&points[s+n/2]);
+		if (!pointers.empty()) SFCNN_PREFETCH(&pointers[s+n/2]);
+		if (use_keys && (n >= leaf_size)) SFCNN_PREFETCH(&keys[s+n/2]);
+	}
+
+	/*
+	  kNN traversal of the sorted array as an implicit binary tree, in the
+	  order of the original recursion.  It descends into the half on the
+	  side of the query at once and keeps the other half on an explicit
+	  stack.  Both halves are prefetched before the order is decided, so
+	  the cache misses of the next level overlap the work on this one.
+	  Nodes are numbered breadth first as long as they can be in the hot
+	  array, and those in it are read from there.
+	*/
+	void traverse(qknn &ans, query_state &st) {
+		trav_entry stack[trav_depth];
+		unsigned int top = 0;
+		long unsigned int s = 0;
+		long unsigned int n = points.size();
+		long unsigned int node = 1;
+		const long unsigned int nhot = hot.size();
+
+		for (;;) {
+			if (n < leaf_size) {
+				if ((n > 0) && blocks_beyond(st, s, s+n-1, reach(ans, st))) n = 0;
+				double d[max_leaf];
+				if (n > 0) leaf_dist(s, n, st, d);
+				bool update=false;
+				for (long unsigned int i=0; i < n; ++i) {
+					if ((s+i >= st.scan_lo)
+					        && (s+i < st.scan_hi))
+						continue;
+					spend(st);
+					update = ans.update(d[i], id_at(s+i)) || update;
+				}
+				if (update)
+					compute_bounding_box(st, sqrt(reach(ans, st)));
+			} else if (blocks_beyond(st, s, s+n-1, reach(ans, st))) {
+				// the middle point is no nearer than its blocks, skip it too
+			} else {
+				const long unsigned int m = s+n/2;
+				const bool is_hot = (node < nhot);
+				if (2*node >= nhot) {
+					prefetch_range(s, n/2);
+					prefetch_range(m+1, n-n/2-1);
+				}
+				const Point &mid = is_hot ? hot[node].mid : points[m];
+
+				if ((m < st.scan_lo) || (m >= st.scan_hi)) {
+					spend(st);
+					if (ans.update(mid.sqr_dist(st.q), is_hot ? hot[node].pointer : id_at(m)))
+						compute_bounding_box(st, sqrt(reach(ans, st)));
+				}
+
+				bool in_box;
+				if (is_hot) {
+					in_box = (lt.dist_sq_to_quad_box(st.q, hot[node].first, hot[node].last) <= reach(ans, st))
+					         && !(use_hilbert && outside_ranges(st, hot_keys[node].first, hot_keys[node].last));
+				} else {
+					in_box = (lt.dist_sq_to_quad_box(st.q, points[s], points[s+n-1]) <= reach(ans, st))
+					         && !outside_ranges(st, s, s+n-1);
+				}
+				if (in_box) {
+					trav_entry &e = stack[top++];
+					e.m = m;
+					e.parent = is_hot ? node : 0;
+					e.upper = query_before(st, mid, is_hot ? hot_mid_key(node) : key_at(m));
+					const long unsigned int left = is_hot ? 2*node : node;
+					const long unsigned int right = is_hot ? 2*node+1 : node;
+					if (e.upper) {
+						e.s = m+1;
+						e.n = n-n/2-1;
+						e.node = right;
+						n = n/2;
+						node = left;
+					} else {
+						e.s = s;
+						e.n = n/2;
+						e.node = left;
+						s = m+1;
+						n = n-n/2-1;
+						node = right;
+					}
+					if (!st.stopped) continue;
+				}
+			}
+
+			// pop the next deferred half that is still in the box
+			for (;;) {
+				if ((top == 0) || st.stopped) return;
+				const trav_entry &e = stack[--top];
+				bool in_box;
+				if (e.parent) {
+					const Point &mid = hot[e.parent].mid;
+					in_box = e.upper ? before_upper(st, mid, hot_mid_key(e.parent))
+					         : lower_before(st, mid, hot_mid_key(e.parent));
+				} else {
+					in_box = e.upper ? before_upper(st, e.m) : lower_before(st, e.m);
+				}
+				if (in_box) {
+					s = e.s;
+					n = e.n;
+					node = e.node;
+					break;
+				}
+			}
+		}
+	}
 
-			bool update=false;
+	/*! Key of the middle point of a hot node, null without keys */
+	const key_type *hot_mid_key(long unsigned int node) const {
+		return use_keys ? &hot_keys[node].mid : 0;
+	}
+
+	/*! Keep a point found within sqrt(r_sq) */
+	void collect(std::vector<std::pair<double, long unsigned int> > &found, double d, long unsigned int i,
+	             double &, query_state &) {
+		found.push_back(std::make_pair(d, id_at(i)));
+	}
+	/*! Offer a point found within sqrt(r_sq) to a capped search, whose
+	  radius becomes that of its farthest point once it is full */
+	void collect(qknn &que, double d, long unsigned int i, double &r_sq, query_state &st) {
+		if (!que.update(d, id_at(i)) || !(que.topdist() < r_sq)) return;
+		r_sq = que.topdist();
+		compute_bounding_box(st, sqrt(r_sq));
+	}
+
+	/*
+	  Collects every point within sqrt(r_sq) of the query.  A half is
+	  skipped when the middle point lies strictly beyond the box corner on
+	  its side, so points equal to a corner are still visited.  A capped
+	  search may shrink r_sq and the box as it goes.
+	*/
+	template <typename Found>
+	void rrecurse(long unsigned int s, long unsigned int n, double &r_sq, Found &found, query_state &st) {
+		if (n < leaf_size) {
+			if (n == 0) return;
+			double d[max_leaf];
+			leaf_dist(s, n, st, d);
 			for (long unsigned int i=0; i < n; ++i) {
-				if ((s+i >= initial_scan_lower_range)
-				        && (s+i < initial_scan_upper_range))
-					continue;
-				update = ans.update(points[s+i].sqr_dist(q), pointers[s+i]) || update;
+				if (d[i] <= r_sq) collect(found, d[i], s+i, r_sq, st);
 			}
-			if (update)
-				compute_bounding_box(q, bound_box_lower_corner, bound_box_upper_corner, sqrt(ans.topdist()));
 			return;
 		}
 
-		if ((s+n/2 >= initial_scan_lower_range) && (s+n/2 < initial_scan_upper_range)) {
-		} else if (ans.update(points[s+n/2].sqr_dist(q), pointers[s+n/2]))
-			compute_bounding_box(q, bound_box_lower_corner, bound_box_upper_corner, sqrt(ans.topdist()));
+		double d = points[s+n/2].sqr_dist(st.q);
+		if (d <= r_sq) collect(found, d, s+n/2, r_sq, st);
 
-		double dsqb = lt.dist_sq_to_quad_box(q,points[s], points[s+n-1]);
+		if (lt.dist_sq_to_quad_box(st.q, points[s], points[s+n-1]) > r_sq) return;
+		if (outside_ranges(st, s, s+n-1)) return;
+		if (blocks_beyond(st, s, s+n-1, r_sq)) return;
+		if (!before_lower(st, s+n/2))
+			rrecurse(s, n/2, r_sq, found, st);
+		if (!upper_before(st, s+n/2))
+			rrecurse(s+n/2+1, n-n/2-1, r_sq, found, st);
+	}
 
-		if (dsqb > ans.topdist()) return;
-		if (lt(q,points[s+n/2])) {
-			recurse(s, n/2, q, ans, bound_box_lower_corner, bound_box_upper_corner, initial_scan_lower_range, initial_scan_upper_range);
-			if (lt(points[s+n/2],bound_box_upper_corner))
-				recurse(s+n/2+1,n-n/2-1, q, ans, bound_box_lower_corner, bound_box_upper_corner, initial_scan_lower_range, initial_scan_upper_range);
-		} else {
-			recurse(s+n/2+1, n-n/2-1, q, ans, bound_box_lower_corner, bound_box_upper_corner, initial_scan_lower_range, initial_scan_upper_range);
-			if (lt(bound_box_lower_corner,points[s+n/2]))
-				recurse(s, n/2, q, ans, bound_box_lower_corner, bound_box_upper_corner, initial_scan_lower_range, initial_scan_upper_range);
+	/*! What a window search gives the visitor for point i */
+	long unsigned int visit_at(const query_state &st, long unsigned int i) const {
+		return st.sorted ? i : id_at(i);
+	}
+
+	/* True if p lies in the window of st */
+	bool in_window(const Point &p, const query_state &st) {
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			if ((p[j] < st.lower[j]) || (p[j] > st.upper[j])) return false;
 		}
+		return true;
+	}
+
+	/*
+	  Visits the points of [s, s+n) inside the window.  The quadtree box
+	  shortcuts are only taken for integral coordinates, whose boxes are
+	  exact; other types fall back to testing every point left after the
+	  z-order pruning.
+	*/
+	template <typename Visitor>
+	bool wrecurse(long unsigned int s, long unsigned int n, query_state &st, Visitor &visit) {
+		if (n < leaf_size) {
+			for (long unsigned int i=s; i < s+n; ++i) {
+				if (in_window(points[i], st) && !visit(visit_at(st, i))) return false;
+			}
+			return true;
+		}
+
+		if (int_coords) {
+			Point bl, bu;
+			lt.min_quad_box(points[s], points[s+n-1], bl, bu);
+			bool inside = true;
+			for (unsigned int j=0; j < Point::__DIM; ++j) {
+				if ((bu[j] < st.lower[j]) || (bl[j] > st.upper[j])) return true;
+				if ((bl[j] < st.lower[j]) || (bu[j] > st.upper[j])) inside = false;
+			}
+			if (inside) {
+				for (long unsigned int i=s; i < s+n; ++i) {
+					if (!visit(visit_at(st, i))) return false;
+				}
+				return true;
+			}
+		}
+
+		if (outside_ranges(st, s, s+n-1)) return true;
+
+		long unsigned int m = s+n/2;
+		if (!before_lower(st, m) && !wrecurse(s, n/2, st, visit)) return false;
+		if (in_window(points[m], st) && !visit(visit_at(st, m))) return false;
+		if (!upper_before(st, m) && !wrecurse(m+1, n-n/2-1, st, visit)) return false;
+		return true;
 	}
 };
 #endif // __SFCDATA_WORK___
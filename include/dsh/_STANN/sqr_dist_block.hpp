@@ -0,0 +1,186 @@
+/*****************************************************************************/
+/*                                                                           */
+/*  Header: sqr_dist_block.hpp                                               */
+/*                                                                           */
+/*  Accompanies STANN Version 0.70 B                                         */
+/*                                                                           */
+/*  (added by Shreos Roychowdhury)                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SFCNN_SQR_DIST_BLOCK__
+#define __SFCNN_SQR_DIST_BLOCK__
+
+#include <cstddef>
+#include <limits>
+#include <boost/static_assert.hpp>
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(SFCNN_NO_SIMD)
+#define SFCNN_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/*! \file
+  \brief Squared distances from a query to a block of contiguous points
+
+  The points of a dpoint array lie one after the other, so a block of n
+  points is n*DIM coordinates that a vector loop can read in one stream.
+  Integral coordinates are subtracted as integers and the difference is
+  converted to double, which is exact while it is below 2^51; exact()
+  tells whether a point is in that range.  In that range the results are
+  bitwise those of dpoint::sqr_dist.
+
+  The vector loops exist for 2 dimensional 64 bit integer points, the
+  coordinate type of the server, and are chosen at runtime between SSE2
+  and AVX2 from what the CPU supports.  Other points use a scalar loop.
+*/
+
+//! Block kernel, scalar
+/*! out[i] is the squared distance of point i of p to q */
+template<typename CType, unsigned int DIM>
+class sqr_dist_kernel {
+public:
+	typedef void (*kernel)(const CType *p, unsigned int n, const CType *q, double *out);
+	static void scalar(const CType *p, unsigned int n, const CType *q, double *out) {
+		for (unsigned int i=0; i < n; ++i, p += DIM) {
+			double d = (double) p[0] - (double) q[0];
+			double s = d*d;
+			for (unsigned int j=1; j < DIM; ++j) {
+				d = (double) p[j] - (double) q[j];
+				s = d*d + s;
+			}
+			out[i] = s;
+		}
+	}
+	static kernel select(const char **name) {
+		*name = "scalar";
+		return scalar;
+	}
+};
+
+#ifdef SFCNN_SIMD_X86
+//! Block kernel for 2 dimensional 64 bit integer points
+/*!
+  There is no int64 to double conversion below AVX-512, so the integer
+  difference d is added to the bits of 2^52+2^51 and that value is
+  subtracted again as a double.  AVX-512 with its conversion was measured
+  no faster than this on blocks of 16 to 64 points.  The squares of x and y of a point sit in
+  adjacent lanes and are added pairwise.
+*/
+template<>
+class sqr_dist_kernel<long int, 2> {
+public:
+	typedef void (*kernel)(const long int *p, unsigned int n, const long int *q, double *out);
+
+	static void scalar(const long int *p, unsigned int n, const long int *q, double *out) {
+		for (unsigned int i=0; i < n; ++i, p += 2) {
+			double dx = (double) (p[0] - q[0]);
+			double dy = (double) (p[1] - q[1]);
+			out[i] = dy*dy + dx*dx;
+		}
+	}
+
+	__attribute__((target("sse2")))
+	static void sse2(const long int *p, unsigned int n, const long int *q, double *out) {
+		const __m128i bias = _mm_set1_epi64x(0x4338000000000000L);
+		const __m128d fbias = _mm_set1_pd(6755399441055744.0);
+		const __m128i qv = _mm_loadu_si128((const __m128i *) q);
+		unsigned int i = 0;
+		for (; i+2 <= n; i += 2) {
+			__m128i da = _mm_sub_epi64(_mm_loadu_si128((const __m128i *) (p+2*i)), qv);
+			__m128i db = _mm_sub_epi64(_mm_loadu_si128((const __m128i *) (p+2*i+2)), qv);
+			__m128d fa = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(da, bias)), fbias);
+			__m128d fb = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(db, bias)), fbias);
+			fa = _mm_mul_pd(fa, fa);
+			fb = _mm_mul_pd(fb, fb);
+			_mm_storeu_pd(out+i, _mm_add_pd(_mm_unpackhi_pd(fa, fb), _mm_unpacklo_pd(fa, fb)));
+		}
+		scalar(p+2*i, n-i, q, out+i);
+	}
+
+	__attribute__((target("avx2")))
+	static void avx2(const long int *p, unsigned int n, const long int *q, double *out) {
+		const __m256i bias = _mm256_set1_epi64x(0x4338000000000000L);
+		const __m256d fbias = _mm256_set1_pd(6755399441055744.0);
+		const __m256i qv = _mm256_set_epi64x(q[1], q[0], q[1], q[0]);
+		unsigned int i = 0;
+		for (; i+4 <= n; i += 4) {
+			__m256i da = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *) (p+2*i)), qv);
+			__m256i db = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *) (p+2*i+4)), qv);
+			__m256d fa = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(da, bias)), fbias);
+			__m256d fb = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(db, bias)), fbias);
+			fa = _mm256_mul_pd(fa, fa);
+			fb = _mm256_mul_pd(fb, fb);
+			// pairwise sums come out as points 0 2 1 3
+			__m256d s = _mm256_hadd_pd(fa, fb);
+			_mm256_storeu_pd(out+i, _mm256_permute4x64_pd(s, 0xd8));
+		}
+		scalar(p+2*i, n-i, q, out+i);
+	}
+
+	static kernel select(const char **name) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			*name = "avx2";
+			return avx2;
+		}
+		*name = "sse2";
+		return sse2;
+	}
+};
+#endif
+
+//! Squared distances to a block of points
+template<typename Point>
+class sqr_dist_block {
+public:
+	typedef typename Point::__NumType CType;
+	static const unsigned int DIM = Point::__DIM;
+	/*! True if the block distances to and from p equal sqr_dist.  For 64
+	  bit integral coordinates they must lie within +-2^50. */
+	static bool exact(const Point &p) {
+		if (!std::numeric_limits<CType>::is_integer || (sizeof(CType) < 8)) return true;
+		const CType lim = (CType) (1L << 50);
+		for (unsigned int j=0; j < DIM; ++j) {
+			if (p[j] > lim) return false;
+			if (std::numeric_limits<CType>::is_signed && (p[j] < -lim)) return false;
+		}
+		return true;
+	}
+
+	/*! Squared distances
+	  \param p First point of the block
+	  \param n Number of points
+	  \param q Query point
+	  \param out Return value, out[i] is p[i].sqr_dist(q)
+	*/
+	static void eval(const Point *p, unsigned int n, const Point &q, double *out) {
+		// a point is its coordinates and nothing else
+		BOOST_STATIC_ASSERT(sizeof(Point) == DIM*sizeof(CType));
+		CType qa[DIM];
+		for (unsigned int j=0; j < DIM; ++j)
+			qa[j] = q[j];
+		kernel()(reinterpret_cast<const CType *>(p), n, qa, out);
+	}
+
+	/*! Name of the vector loop in use */
+	static const char *name() {
+		const char *n;
+		sqr_dist_kernel<CType, DIM>::select(&n);
+		return n;
+	}
+
+	/*! The scalar dpoint::sqr_dist on a block, for comparison */
+	static void eval_scalar(const Point *p, unsigned int n, const Point &q, double *out) {
+		for (unsigned int i=0; i < n; ++i)
+			out[i] = p[i].sqr_dist(q);
+	}
+
+private:
+	static typename sqr_dist_kernel<CType, DIM>::kernel kernel() {
+		static const char *n;
+		static const typename sqr_dist_kernel<CType, DIM>::kernel k = sqr_dist_kernel<CType, DIM>::select(&n);
+		return k;
+	}
+};
+#endif
@@ -0,0 +1,308 @@
+/*****************************************************************************/
+/*                                                                           */
+/*  Header: zorder_key.hpp                                                   */
+/*                                                                           */
+/*  Accompanies STANN Version 0.70 B                                         */
+/*                                                                           */
+/*  (added by Shreos Roychowdhury)                                           */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SFCNN_ZORDER_KEY__
+#define __SFCNN_ZORDER_KEY__
+
+#include <climits>
+#include <vector>
+#include <boost/array.hpp>
+#include "zorder_type_traits.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(SFCNN_NO_SIMD)
+#define SFCNN_BMI2_X86 1
+#include <immintrin.h>
+#endif
+
+/*! \file
+  \brief Precomputed z-order (Morton) keys and their radix sort
+
+  A key interleaves the bits of all coordinates of a point, most
+  significant bit first and dimension 0 first within a bit level, which
+  is the same order zorder_lt computes with its XOR/MSB race.  Signed
+  coordinates have their sign bit flipped so that the unsigned key order
+  matches the signed coordinate order, and float and double coordinates
+  are mapped to bits in their order by zorder_float_bits.  That is not
+  the order of the sep_float comparator, so zorder_lt is switched to the
+  key order when an index of them is built on keys.
+
+  Two dimensional keys are interleaved with the BMI2 pdep instruction
+  when the CPU has it, which deposits the bits of a coordinate at every
+  other bit of a word in one step.  Other keys, and CPUs without BMI2,
+  spread the coordinates a byte at a time through a table.
+*/
+
+using namespace std;
+
+//! Key coordinate mapping
+/*! Maps a coordinate to an unsigned integer of the same width whose
+  unsigned order is the order of the coordinate.  Unspecialized types
+  cannot be keyed. */
+template<typename CType, typename sign_trait, typename integral_trait>
+class zorder_key_coord {
+public:
+	static const bool valid = false;
+	static unsigned long int encode(CType) {
+		return 0;
+	}
+};
+
+//! Key coordinate mapping for unsigned integral types
+template<typename CType>
+class zorder_key_coord<CType, zorder_f, zorder_t> {
+public:
+	static const bool valid = (sizeof(CType) <= sizeof(unsigned long int));
+	static unsigned long int encode(CType x) {
+		return (unsigned long int) x;
+	}
+};
+
+//! Key coordinate mapping for signed integral types
+template<typename CType>
+class zorder_key_coord<CType, zorder_t, zorder_t> {
+public:
+	static const bool valid = (sizeof(CType) <= sizeof(unsigned long int));
+	static unsigned long int encode(CType x) {
+		const unsigned int bits = sizeof(CType)*CHAR_BIT;
+		const unsigned long int mask = (bits < sizeof(unsigned long int)*CHAR_BIT) ? ((1UL << bits) - 1) : ~0UL;
+		return (((unsigned long int) x) & mask) ^ (1UL << (bits-1));
+	}
+};
+
+//! Key coordinate mapping for float and double
+template<typename CType>
+class zorder_key_coord<CType, zorder_t, zorder_f> {
+public:
+	static const bool valid = zorder_float_bits<CType>::valid;
+	static unsigned long int encode(CType x) {
+		return (unsigned long int) zorder_float_bits<CType>::encode(x);
+	}
+};
+
+//! Z-order key
+/*! \brief Computes the interleaved z-order key of a point
+
+  The key is stored as an array of 64 bit words, word 0 being the most
+  significant, so that keys compare with the lexicographic operator< of
+  boost::array.  The table interleave spreads each coordinate a byte at
+  a time, placing bit i of the byte at bit i*DIM.
+*/
+template<typename Point>
+class zorder_key {
+public:
+	typedef typename Point::__NumType CType;
+	typedef zorder_key_coord<CType,
+	        typename zorder_traits<CType>::is_signed,
+	        typename zorder_traits<CType>::is_integral> coord;
+
+	static const unsigned int DIM = Point::__DIM;
+	static const unsigned int BITS = sizeof(CType)*CHAR_BIT;
+	static const unsigned int WORDS = (DIM*BITS + 63)/64;
+	typedef boost::array<unsigned long int, WORDS> key_type;
+
+	/*! True if keys can be made for this coordinate type */
+	static const bool valid = coord::valid && (DIM <= 8);
+
+	/*! Make key
+	  \param p Point
+	  \param k Return value, key of p
+	*/
+	static void make(const Point &p, key_type &k) {
+		unsigned long int c[DIM];
+		for (unsigned int d=0; d < DIM; ++d)
+			c[d] = coord::encode(p[d]);
+		interleave(c, k);
+	}
+
+	/*! Interleave encoded coordinates
+	  \param e Encoded coordinates, BITS bits each, dimension 0 first
+	  \param k Return value, key with the bits of e interleaved
+	*/
+	static void interleave(const unsigned long int *e, key_type &k) {
+#ifdef SFCNN_BMI2_X86
+		static const bool bmi2 = has_bmi2();
+		if (bmi2) {
+			interleave_pdep(e, k);
+			return;
+		}
+#endif
+		interleave_table(e, k);
+	}
+
+	/*! Name of the interleave in use */
+	static const char *interleave_name() {
+#ifdef SFCNN_BMI2_X86
+		if (has_bmi2()) return "pdep";
+#endif
+		return "table";
+	}
+
+	/*! The table interleave, for any key and CPU */
+	static void interleave_table(const unsigned long int *e, key_type &k) {
+		static const spread_table table;
+		k.assign(0);
+		for (unsigned int d=0; d < DIM; ++d) {
+			unsigned long int c = e[d];
+			for (unsigned int b=0; b < BITS/8; ++b, c >>= 8) {
+				unsigned long int v = table.spread[c & 0xff];
+				if (v == 0) continue;
+				// bit position of this chunk counted from the least significant end
+				unsigned int pos = b*8*DIM + (DIM-1-d);
+				unsigned int w = WORDS - 1 - pos/64;
+				unsigned int sh = pos%64;
+				k[w] |= v << sh;
+				if ((sh > 0) && (w > 0)) k[w-1] |= v >> (64-sh);
+			}
+		}
+	}
+
+	/*! Set the low bits of a key
+	  \param k Key
+	  \param nbits Number of low bits to set
+	  \param ones Set them to one if true, to zero otherwise
+	*/
+	static void fill_low(key_type &k, unsigned int nbits, bool ones) {
+		for (unsigned int w=WORDS; (w > 0) && (nbits > 0); --w) {
+			unsigned long int m = (nbits >= 64) ? ~0UL : ((1UL << nbits) - 1);
+			k[w-1] = ones ? (k[w-1] | m) : (k[w-1] & ~m);
+			nbits = (nbits >= 64) ? nbits-64 : 0;
+		}
+	}
+
+	/*! Bits of a key, counted from the most significant
+	  \param k Key
+	  \param from First bit, 0 is the most significant bit of word 0
+	  \param nbits Number of bits, 1 to 64
+	  \return The bits from .. from+nbits-1 of k as an integer, zeros
+	  past the end of the key
+	*/
+	static unsigned long int bits(const key_type &k, unsigned int from, unsigned int nbits) {
+		const unsigned int w = from/64;
+		const unsigned int sh = from%64;
+		unsigned long int v = (w < WORDS) ? (k[w] << sh) : 0;
+		if ((sh > 0) && (w+1 < WORDS)) v |= k[w+1] >> (64-sh);
+		return v >> (64-nbits);
+	}
+
+	/*! Number of leading bits two keys have in common */
+	static unsigned int common_bits(const key_type &a, const key_type &b) {
+		for (unsigned int w=0; w < WORDS; ++w) {
+			unsigned long int x = a[w] ^ b[w];
+			if (x == 0) continue;
+			unsigned int n = w*64;
+			for (; !(x & (1UL << 63)); x <<= 1) ++n;
+			return n;
+		}
+		return WORDS*64;
+	}
+
+	/*! Less than on keys, word 0 first */
+	static bool less(const key_type &a, const key_type &b) {
+		for (unsigned int w=0; w < WORDS; ++w) {
+			if (a[w] != b[w]) return a[w] < b[w];
+		}
+		return false;
+	}
+
+private:
+#ifdef SFCNN_BMI2_X86
+	/* true if pdep can be used for this key */
+	static bool has_bmi2() {
+		if ((DIM != 2) || (BITS > 64)) return false;
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("bmi2");
+	}
+
+	/* Dimension 0 goes to the odd bits, so a word of the key holds 32
+	   bits of each coordinate, the high halves in word 0 */
+	__attribute__((target("bmi2")))
+	static void interleave_pdep(const unsigned long int *e, key_type &k) {
+		const unsigned long int odd = 0xaaaaaaaaaaaaaaaaUL;
+		const unsigned long int even = 0x5555555555555555UL;
+		if (BITS <= 32) {
+			k[WORDS-1] = _pdep_u64(e[0], odd) | _pdep_u64(e[1], even);
+			return;
+		}
+		k[0] = _pdep_u64(e[0] >> 32, odd) | _pdep_u64(e[1] >> 32, even);
+		k[WORDS-1] = _pdep_u64(e[0] & 0xffffffffUL, odd) | _pdep_u64(e[1] & 0xffffffffUL, even);
+	}
+#endif
+
+	struct spread_table {
+		spread_table() {
+			for (unsigned int i=0; i < 256; ++i) {
+				spread[i] = 0;
+				for (unsigned int j=0; j < 8; ++j)
+					if ((i >> j) & 1U) spread[i] |= 1UL << (j*DIM);
+			}
+		}
+		unsigned long int spread[256];
+	};
+};
+
+//! Radix sort by z-order key
+/*!
+  LSD radix sort of the keys, one byte per pass, moving the points and
+  pointers along with them.  Bytes that are equal in all keys are
+  skipped, so the number of passes depends on the spread of the data,
+  not on the width of the coordinate type.  The sort is stable, so equal
+  keys stay in their input order.
+  \param keys Keys to sort
+  \param points Points, permuted with the keys
+  \param pointers Pointers, permuted with the keys
+*/
+template<typename Key, typename Point, typename Ptr>
+void zorder_key_sort(vector<Key> &keys, vector<Point> &points, vector<Ptr> &pointers)
+{
+	const std::size_t N = keys.size();
+	const unsigned int bytes = sizeof(typename Key::value_type)*Key::static_size;
+	vector<vector<std::size_t> > count(bytes, vector<std::size_t>(256, 0));
+
+	for (std::size_t i=0; i < N; ++i) {
+		for (unsigned int j=0; j < bytes; ++j) {
+			++count[j][(keys[i][Key::static_size - 1 - j/8] >> ((j%8)*8)) & 0xff];
+		}
+	}
+
+	vector<Key> tkeys;
+	vector<Point> tpoints;
+	vector<Ptr> tpointers;
+	for (unsigned int j=0; j < bytes; ++j) {
+		vector<std::size_t> &c = count[j];
+		bool trivial = false;
+		for (unsigned int b=0; b < 256; ++b) {
+			if (c[b] == N) trivial = true;
+		}
+		if (trivial) continue;
+		if (tkeys.size() != N) {
+			tkeys.resize(N);
+			tpoints.resize(N);
+			tpointers.resize(N);
+		}
+		std::size_t sum = 0;
+		for (unsigned int b=0; b < 256; ++b) {
+			std::size_t t = c[b];
+			c[b] = sum;
+			sum += t;
+		}
+		const unsigned int w = Key::static_size - 1 - j/8;
+		const unsigned int shift = (j%8)*8;
+		for (std::size_t i=0; i < N; ++i) {
+			std::size_t to = c[(keys[i][w] >> shift) & 0xff]++;
+			tkeys[to] = keys[i];
+			tpoints[to] = points[i];
+			tpointers[to] = pointers[i];
+		}
+		keys.swap(tkeys);
+		points.swap(tpoints);
+		pointers.swap(tpointers);
+	}
+}
+#endif
@@ -26,12 +26,51 @@
 #include "zorder_type_traits.hpp"
 #include "sep_float.hpp"
 #include "pair_iter.hpp"
+#include <boost/type_traits/make_unsigned.hpp>
 /*! \file
   \brief Contains implementation of various z-order functions for defined types
 */
 
 using namespace std;
 
+//! Quadtree box helpers for integral coordinates
+/*! A quadtree box of level i is aligned to 2^i in every dimension.  Its
+  corners are computed with masks on the unsigned type, so they cannot
+  overflow the coordinate type. */
+template<typename CType>
+class zorder_int_box {
+public:
+	typedef typename boost::make_unsigned<CType>::type UType;
+	static const int BITS = sizeof(CType)*CHAR_BIT;
+
+	/*! Level of the smallest box holding two coordinates whose XOR is x,
+	  the number of bits up to its most significant set bit */
+	static int level(UType x) {
+#ifdef __GNUC__
+		if (x == 0) return 0;
+		if (sizeof(UType) <= sizeof(unsigned int))
+			return (int) (sizeof(unsigned int)*CHAR_BIT) - __builtin_clz((unsigned int) x);
+		if (sizeof(UType) <= sizeof(unsigned long int))
+			return (int) (sizeof(unsigned long int)*CHAR_BIT) - __builtin_clzl((unsigned long int) x);
+#endif
+		int i = 0;
+		for (; x; x >>= 1) ++i;
+		return i;
+	}
+	/*! Lower corner of the level i box holding c */
+	static CType lower(CType c, int i) {
+		return (CType) (((UType) c) & ~mask(i));
+	}
+	/*! Upper corner, inclusive, of the level i box holding c */
+	static CType upper(CType c, int i) {
+		return (CType) (((UType) c) | mask(i));
+	}
+private:
+	static UType mask(int i) {
+		return (i >= BITS) ? ~((UType) 0) : ((((UType) 1) << i) - 1);
+	}
+};
+
 template<typename Point>
 class zorder_lt;
 template<typename Point, typename CType, typename sign_trait, typename integral_trait, typename sep_trait>
@@ -77,6 +116,13 @@ public:
 	void set_offset(CType off) {
 		offset=off;
 	}
+	/*! Integral points are always ordered as their zorder_key keys */
+	void set_ordered(bool) {
+		;
+	}
+	bool key_order() const {
+		return true;
+	}
 	/*! Distance (Squared) to Quadtree Box
 	\brief Computes the distance from a query point to the smallest quadtree
 	box containing two other points.
@@ -91,78 +137,47 @@ public:
 	\return Squared distance from q to quadtree box.  0 if q lies within box
 	*/
 	double dist_sq_to_quad_box(const Point &q, const Point &p1, const Point &p2) {
-		unsigned int j;
-		int i;
-		CType x,y;
-		double z;
-		z=0;
-		x=0;
-		for (j=0; j < Point::__DIM; ++j) {
-			y = (CType) (p1[j]^p2[j]);
-			if (less_msb(x, y)) {
-				x = y;
-			}
-		}
-		frexp((float)x, &i);
-		for (j=0; j < Point::__DIM; ++j) {
-			x = (CType) ((((p1)[j])>>i)<<i);
-			y = (CType) ((int) x+(1 << i));
+		int i = quad_box_level(p1, p2);
+		double z = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			CType x = zorder_int_box<CType>::lower(p1[j], i);
+			CType y = zorder_int_box<CType>::upper(p1[j], i);
+			double d;
 			if (q[j] < x)
-				z+= pow(((double) q[j]-(double) x), 2.0);
+				d = (double) q[j]-(double) x;
 			else if (q[j] > y)
-				z+= pow(((double) q[j]-(double) y), 2.0);
+				d = (double) q[j]-(double) y;
+			else
+				continue;
+			z += d*d;
 		}
 		return z;
 	}
 
 	/*! Quadtree Box Length
-	    \brief Computes the side length of the smallest quadtree box containing two points
+	    \brief Computes the extent of the smallest quadtree box containing two points
 	    \param p1 First point
 	    \param p2 Second point
-	    \return The side length of the smallest quadtree box containing p1 and p2
+	    \return The upper corner minus the lower corner of the smallest quadtree
+	    box containing p1 and p2, its side length minus one as the upper corner
+	    is inclusive
 	  */
 	double quad_box_length(const Point &p1, const Point &p2) {
-		unsigned int j;
-		int i;
-		CType x,y;
-		double length;
-
-		x = 0;
-		if (p1 == p2)
-			return 0;
-		for (j=0; j < Point::__DIM; ++j) {
-			if ((p1[j] < 0) != (p2[j] < 0)) {
-				return 0;
-			}
-			y = p1[j]^p2[j];
-			if (less_msb(x,y)) x=y;
-		}
-		length = pow((CType) 2.0,x);
-		return length;
+		return ldexp(1.0, quad_box_level(p1, p2)) - 1;
 	};
 	/*! Minimum Enclosing Quadtree Box
 	  \brief Computes the lower and upper corners of the smallest quadtree box containing two points
 	  \param p1 First point
 	  \param p2 Second point
 	  \param lcorner Return value, lower corner
-	  \param ucorner Return value, upper corner
+	  \param ucorner Return value, upper corner, inclusive
 	*/
 	void min_quad_box(const Point &p1, const Point &p2, Point &lcorner, Point &ucorner) {
-		double length = quad_box_length(p1, p2);
-		if (length==0) {
-			lcorner=p1;
-			ucorner=p1;
-			return;
-		} else if (length == (numeric_limits<CType>::max)()) {
-			for (unsigned int j=0; j <  Point::__DIM; ++j) {
-				lcorner[j] = -(numeric_limits<CType>::max)();
-				ucorner[j] = (numeric_limits<CType>::max)();
-			}
-		} else
-			for (unsigned int j=0; j < Point::__DIM; ++j) {
-				lcorner[j]  = floor(p1[j] / length) * length;
-				ucorner[j]  = lcorner[j]+length;
-			}
+		int i = quad_box_level(p1, p2);
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			lcorner[j] = zorder_int_box<CType>::lower(p1[j], i);
+			ucorner[j] = zorder_int_box<CType>::upper(p1[j], i);
+		}
 	}
 	/*! Distance (Squared) between two Quadtree Boxs
 	    \brief Computes the distance between two quadtree boxes defined by two sets of two points
@@ -252,6 +267,14 @@ private:
 	bool less_msb(CType x, CType y) {
 		return (x < y) && (x < (x^y));
 	}
+
+	/* level of the smallest quadtree box holding p1 and p2 */
+	int quad_box_level(const Point &p1, const Point &p2) {
+		CType x = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j)
+			x |= (CType) (p1[j]^p2[j]);
+		return zorder_int_box<CType>::level(x);
+	}
 };
 
 
@@ -295,6 +318,13 @@ public:
 	void set_offset(CType off) {
 		offset=off;
 	}
+	/*! Integral points are always ordered as their zorder_key keys */
+	void set_ordered(bool) {
+		;
+	}
+	bool key_order() const {
+		return true;
+	}
 	/*! Distance (Squared) to Quadtree Box
 	  \brief Computes the distance from a query point to the smallest quadtree
 	  box containing two other points.
@@ -310,77 +340,56 @@ public:
 	*/
 	double dist_sq_to_quad_box(const Point &q, const Point &p1, const Point &p2) {
 		unsigned int j;
-		int i;
-		CType x,y;
-		double z, X, Y;
-
-		x = (numeric_limits<CType>::min)();
 		for (j=0; j < Point::__DIM; ++j) {
 			if ((p1[j] < 0) != (p2[j] < 0)) {
 				return 0;
 			}
-			y = (CType) (p1[j]^p2[j]);
-			if (less_msb(x,y)) x = y;
 		}
-		frexp((double)x, &i);
-		for (z=j=0; j < Point::__DIM; ++j) {
-			X = (double) ((p1[j]>>i)<<i);
-			Y = (double) (1 << i);
-			Y = Y+X;
+		int i = quad_box_level(p1, p2);
+		double z = 0;
+		for (j=0; j < Point::__DIM; ++j) {
+			double X = (double) zorder_int_box<CType>::lower(p1[j], i);
+			double Y = (double) zorder_int_box<CType>::upper(p1[j], i);
+			double d;
 			if (q[j] < X)
-				z+=pow((X - (double) q[j]), 2.0);
+				d = X - (double) q[j];
 			else if (q[j] > Y)
-				z+=pow(((double) q[j] - Y), 2.0);
+				d = (double) q[j] - Y;
+			else
+				continue;
+			z += d*d;
 		}
 		return z;
 	}
 	/*! Quadtree Box Length
-	    \brief Computes the side length of the smallest quadtree box containing two points
+	    \brief Computes the extent of the smallest quadtree box containing two points
 	    \param p1 First point
 	    \param p2 Second point
-	    \return The side length of the smallest quadtree box containing p1 and p2
+	    \return The upper corner minus the lower corner of the smallest quadtree
+	    box containing p1 and p2, its side length minus one as the upper corner
+	    is inclusive
 	  */
 	double quad_box_length(const Point &p1, const Point &p2) {
-		unsigned int j;
-		int i;
-		CType x,y;
-
-		x = -(numeric_limits<CType>::max)();
-		if (p1 == p2)
-			return 0;
-		for (j=0; j < Point::__DIM; ++j) {
-			if ((p1[j] < 0) != (p2[j] < 0)) {
-				return 0;
-			}
-			y = p1[j]^p2[j];
-			if (less_msb(x,y)) x=y;
-		}
-		x = pow((CType) 2.0,x);
-		return x;
+		return ldexp(1.0, quad_box_level(p1, p2)) - 1;
 	};
 	/*! Minimum Enclosing Quadtree Box
 	  \brief Computes the lower and upper corners of the smallest quadtree box containing two points
 	  \param p1 First point
 	  \param p2 Second point
 	  \param lcorner Return value, lower corner
-	  \param ucorner Return value, upper corner
+	  \param ucorner Return value, upper corner, inclusive
 	*/
 	void min_quad_box(const Point &p1, const Point &p2, Point &lcorner, Point &ucorner) {
-		double length = quad_box_length(p1, p2);
-		if (length==0) {
-			lcorner=p1;
-			ucorner=p1;
-			return;
-		} else if (length == (numeric_limits<CType>::max)()) {
-			for (unsigned int j=0; j <  Point::__DIM; ++j) {
-				lcorner[j] = -(numeric_limits<CType>::max)();
+		int i = quad_box_level(p1, p2);
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			if (i >= zorder_int_box<CType>::BITS) {
+				lcorner[j] = (numeric_limits<CType>::min)();
 				ucorner[j] = (numeric_limits<CType>::max)();
+			} else {
+				lcorner[j] = zorder_int_box<CType>::lower(p1[j], i);
+				ucorner[j] = zorder_int_box<CType>::upper(p1[j], i);
 			}
-		} else
-			for (unsigned int j=0; j < Point::__DIM; ++j) {
-				lcorner[j]  = floor(p1[j] / length) * length;
-				ucorner[j]  = lcorner[j]+length;
-			}
+		}
 	}
 	/*! Distance (Squared) between two Quadtree Boxs
 	    \brief Computes the distance between two quadtree boxes defined by two sets of two points
@@ -456,7 +465,8 @@ private:
 		CType x,y;
 		int j=0;
 		unsigned int k;
-		x = (CType) (-(numeric_limits<CType>::max)());
+		// signs are equal past the check below, so every XOR is non-negative
+		x = 0;
 		for (k=0; k < Point::__DIM; ++k) {
 			if (((p[k]+offset) < 0) != ((q[k]+offset) < 0))
 				return (p[k]+offset) < (q[k]+offset);
@@ -473,6 +483,18 @@ private:
 		return (x < y) && (x < (x^y));
 	}
 
+	/* level of the smallest quadtree box holding p1 and p2, past the sign
+	   bit if their signs differ in any dimension */
+	int quad_box_level(const Point &p1, const Point &p2) {
+		CType x = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			if ((p1[j] < 0) != (p2[j] < 0))
+				return zorder_int_box<CType>::BITS;
+			x |= (CType) (p1[j]^p2[j]);
+		}
+		return zorder_int_box<CType>::level(x);
+	}
+
 };
 
 //Z Order spec for floating point types
@@ -493,6 +515,7 @@ public:
 	*/
 	zorder_lt_worker() {
 		offset=0;
+		ordered=false;
 	}
 	/*! Destructor
 	  \brief Default destructor
@@ -503,6 +526,22 @@ public:
 	void set_offset(CType off) {
 		offset = off;
 	}
+	/*! Key Order
+	  \brief Orders points as their zorder_key keys
+
+	  When set the points are ordered on the bits of zorder_float_bits,
+	  which keep the order of the values, instead of on their sep_float
+	  parts, and the quadtree boxes are those of the bits, decoded back
+	  to the coordinate type.  Not set by default.
+	  \param o True for the key order
+	*/
+	void set_ordered(bool o) {
+		ordered = o && zorder_float_bits<CType>::valid;
+	}
+	/*! True if points are ordered as their zorder_key keys */
+	bool key_order() const {
+		return ordered;
+	}
 	/*! Function Object Operator
 	  \brief Calls less than operator
 
@@ -522,6 +561,16 @@ public:
 	  \return The side length of the smallest quadtree box containing p1 and p2
 	*/
 	double quad_box_length(const Point &p1, const Point &p2) {
+		if (ordered) {
+			Point lo, hi;
+			ordered_box(p1, p2, lo, hi);
+			double z = 0;
+			for (unsigned int j=0; j < Point::__DIM; ++j) {
+				double d = (double) hi[j] - (double) lo[j];
+				if (d > z) z = d;
+			}
+			return z;
+		}
 		sep_float<CType> p1c, p2c;
 		CType x,y;
 
@@ -550,6 +599,10 @@ public:
 	  \param ucorner Return value, upper corner
 	*/
 	void min_quad_box(const Point &p1, const Point &p2, Point &lcorner, Point &ucorner) {
+		if (ordered) {
+			ordered_box(p1, p2, lcorner, ucorner);
+			return;
+		}
 		CType length = (CType) quad_box_length(p1, p2);
 		if (length==0) {
 			lcorner=p1;
@@ -586,6 +639,7 @@ public:
 		double z;
 		CType box_dist;
 		sep_float<CType> p1c, p2c;
+		if (ordered) return ordered_dist_sq(q, p1, p2);
 		z = 0;
 		x = -(numeric_limits<int>::max)();
 
@@ -599,7 +653,7 @@ public:
 				x = y;
 			}
 		}
-		box_dist = pow(2.0,x);
+		box_dist = ldexp(1.0,x);
 		for (j=0; j < Point::__DIM; ++j) {
 			box_edge_1 = floor(p1[j] / box_dist) * box_dist;
 			box_edge_2 = box_edge_1+box_dist;
@@ -634,6 +688,21 @@ public:
 		CType box_dist1, box_dist2;
 		sep_float<CType> p1c, p2c, q1c, q2c;
 
+		if (ordered) {
+			Point ql, qh, pl, ph;
+			ordered_box(q1, q2, ql, qh);
+			ordered_box(p1, p2, pl, ph);
+			radius1 = quad_box_length(q1, q2);
+			radius2 = quad_box_length(p1, p2);
+			dist = 0;
+			for (j=0; j < Point::__DIM; ++j) {
+				if (qh[j] < pl[j])
+					dist += ((double) pl[j] - qh[j])*((double) pl[j] - qh[j]);
+				else if (ph[j] < ql[j])
+					dist += ((double) ql[j] - ph[j])*((double) ql[j] - ph[j]);
+			}
+			return;
+		}
 		z = 0;
 
 		radius1 = quad_box_length(q1, q2);
@@ -680,7 +749,11 @@ public:
 		return;
 	}
 private:
+	typedef zorder_float_bits<CType> fbits;
+	typedef typename fbits::UType UType;
+
 	bool lt_func(const Point &p, const Point &q) {
+		if (ordered) return ordered_lt(p, q);
 		int y,x;
 		unsigned int k,j;
 		sep_float<CType> pc, qc;
@@ -699,7 +772,55 @@ private:
 		}
 		return p[j] < q[j];
 	}
+	/* XOR/MSB race on the bits of the coordinates, dimension 0 first */
+	bool ordered_lt(const Point &p, const Point &q) {
+		UType pc[Point::__DIM], qc[Point::__DIM];
+		UType x = 0;
+		unsigned int j = 0;
+		for (unsigned int k=0; k < Point::__DIM; ++k) {
+			pc[k] = fbits::encode(p[k]);
+			qc[k] = fbits::encode(q[k]);
+			UType y = pc[k] ^ qc[k];
+			if ((x < y) && (x < (x ^ y))) {
+				j = k;
+				x = y;
+			}
+		}
+		return pc[j] < qc[j];
+	}
+	/* Corners, inclusive, of the smallest box of the bits holding p1 and
+	   p2, the infinities beyond the finite values */
+	void ordered_box(const Point &p1, const Point &p2, Point &lo, Point &hi) {
+		UType e[Point::__DIM];
+		UType x = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			e[j] = fbits::encode(p1[j]);
+			x |= e[j] ^ fbits::encode(p2[j]);
+		}
+		int i = zorder_int_box<UType>::level(x);
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			lo[j] = fbits::decode(zorder_int_box<UType>::lower(e[j], i));
+			hi[j] = fbits::decode(zorder_int_box<UType>::upper(e[j], i));
+		}
+	}
+	double ordered_dist_sq(const Point &q, const Point &p1, const Point &p2) {
+		Point lo, hi;
+		ordered_box(p1, p2, lo, hi);
+		double z = 0;
+		for (unsigned int j=0; j < Point::__DIM; ++j) {
+			double d;
+			if (q[j] < lo[j])
+				d = (double) lo[j] - (double) q[j];
+			else if (q[j] > hi[j])
+				d = (double) q[j] - (double) hi[j];
+			else
+				continue;
+			z += d*d;
+		}
+		return z;
+	}
 	CType offset;
+	bool ordered;
 };
 
 //Z Order spec for seperated floating point types
@@ -732,6 +853,13 @@ public:
 	void set_offset(CType off) {
 		offset=off;
 	}
+	/*! Seperated points are never ordered as zorder_key keys */
+	void set_ordered(bool) {
+		;
+	}
+	bool key_order() const {
+		return false;
+	}
 	/*! Function Object Operator
 	  \brief Calls less than operator
 
@@ -774,7 +902,7 @@ public:
 				x = y;
 			}
 		}
-		box_dist = pow((typename CType::flt_type) 2.0,x);
+		box_dist = ldexp((typename CType::flt_type) 1.0,x);
 		for (j=0; j < Point::__DIM; ++j) {
 			box_edge_1 = floor(p1[j] / box_dist) * box_dist;
 			box_edge_2 = box_edge_1+box_dist;
@@ -799,7 +927,7 @@ public:
 		if (p1 == p2)
 			return 0;
 		for (unsigned int j=0; j < Point::__DIM; ++j) {
-			if ((p1[j].get_flt() < 0) != (p2[j].get_flt < 0)) {
+			if ((p1[j].get_flt() < 0) != (p2[j].get_flt() < 0)) {
 				return (double) (numeric_limits<double>::max)();
 			}
 			y = msdb(p1[j], p2[j]);
@@ -954,6 +1082,20 @@ public:
 	void set_offset(typename Point::__NumType offset) {
 		lt.set_offset(offset);
 	}
+	/*! Key Order
+	  \brief Orders points as their zorder_key keys
+
+	  Integral points always are, float and double points are when this
+	  is set, others never are.
+	  \param o True for the key order
+	*/
+	void set_ordered(bool o) {
+		lt.set_ordered(o);
+	}
+	/*! True if points are ordered as their zorder_key keys */
+	bool key_order() const {
+		return lt.key_order();
+	}
 	/*! Function Object Operator
 	  \brief Calls less than operator
 
@@ -20,6 +20,8 @@
 #define __ZORDER_TYPE_TRAITS__
 
 #include <iostream>
+#include <cstring>
+#include <limits>
 #include "sep_float.hpp"
 
 /*! \file
@@ -228,4 +230,60 @@ public:
 	typedef zorder_t       is_seperated;
 };
 
+//! Order preserving bits of floating point types
+/*! \brief Maps a float or double to an unsigned integer of the same
+  width whose unsigned order is the order of the value.
+
+  Positive values get their sign bit set and negative values have all
+  their bits flipped, so the IEEE bit patterns sort as the values do.
+  -0 is mapped as +0 so that values that compare equal get equal bits.
+  NaN is not ordered and must not be mapped.  Other types cannot be
+  mapped.
+*/
+template<typename CType>
+class zorder_float_bits {
+public:
+	typedef unsigned long int UType;
+	static const bool valid = false;
+	static UType encode(CType) {
+		return 0;
+	}
+	static CType decode(UType) {
+		return CType();
+	}
+};
+
+template<typename FType, typename UIntType>
+class zorder_float_bits_work {
+public:
+	typedef UIntType UType;
+	static const bool valid = (sizeof(FType) == sizeof(UIntType));
+	static const UIntType sign = ((UIntType) 1) << (sizeof(UIntType)*8 - 1);
+
+	/*! The bits of x, x not NaN */
+	static UIntType encode(FType x) {
+		if (x == 0) x = 0;
+		UIntType u;
+		memcpy(&u, &x, sizeof(u));
+		return (u & sign) ? ~u : (u | sign);
+	}
+	/*! The value of bits made by encode, or of any bits between them,
+	    bits beyond those of the infinities give the infinities */
+	static FType decode(UIntType u) {
+		const FType inf = numeric_limits<FType>::infinity();
+		if (u > encode(inf)) return inf;
+		if (u < encode(-inf)) return -inf;
+		u = (u & sign) ? (u & ~sign) : ~u;
+		FType x;
+		memcpy(&x, &u, sizeof(x));
+		return x;
+	}
+};
+
+template<>
+class zorder_float_bits<float> : public zorder_float_bits_work<float, unsigned int> {};
+
+template<>
+class zorder_float_bits<double> : public zorder_float_bits_work<double, unsigned long int> {};
+
 #endif
@@ -0,0 +1,285 @@
+/**
+* @project dishante
+* @file src/Bench.cc
+* @author  S Roychowdhury <sroycode AT gmail DOT com>
+* @version 1.0
+*
+* @section LICENSE
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details at
+* http://www.gnu.org/copyleft/gpl.html
+*
+* @section DESCRIPTION
+*
+* Benchmark of the sfc index: build time, query time and points visited
+* per kNN query for each curve, leaf size, prefix table, hot tree levels
+* and block boxes, on uniform and clustered random data, after
+* microbenchmarks of the leaf distance and z-order kernels
+*
+* usage: dshbench [points] [queries] [k]
+*
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/time.h>
+#include <boost/array.hpp>
+#include <dsh/_STANN/sfcdata_work.hpp>
+#include "Default.hh"
+
+typedef reviver::dpoint<DSHN_DEFAULT_COORDT, 2> BenchPoint;
+typedef std::vector<BenchPoint> BenchVec;
+typedef std::vector<boost::array<DSHN_DEFAULT_COORDT, 2> > BenchArr;
+
+/**
+* Now : wall clock in seconds
+*/
+double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+/**
+* Fill : make random points, uniform or around a few cluster centres
+*
+* @param v
+*   BenchVec points to fill
+*
+* @param centre
+*   BenchVec cluster centres, empty for uniform points
+*
+* @return
+*   none
+*/
+void Fill(BenchVec& v, const BenchVec& centre)
+{
+	const long range = 100000000;
+	const bool clustered = !centre.empty();
+	for (std::size_t i=0; i<v.size(); ++i) {
+		if (!clustered) {
+			v[i][0] = rand()%range;
+			v[i][1] = rand()%range;
+			continue;
+		}
+		const BenchPoint& c = centre[rand()%centre.size()];
+		for (unsigned int j=0; j<2; ++j) {
+			long off = 0;
+			for (int s=0; s<4; ++s) off += rand()%(range/64);
+			v[i][j] = c[j] + off - 2*(range/64);
+		}
+	}
+}
+
+/**
+* Kernel : time the scalar sqr_dist against the block distance kernel
+*
+* @param v
+*   BenchVec points, the first few thousand read in blocks
+*
+* @param block
+*   unsigned int points per block
+*
+* @return
+*   none
+*/
+void Kernel(BenchVec& v, unsigned int block)
+{
+	typedef sqr_dist_block<BenchPoint> K;
+	// a leaf is in cache when it is searched, so are the points here
+	const std::size_t n = (std::min<std::size_t>(v.size(), 4096)/block)*block;
+	const int reps = 10000;
+	std::vector<double> out(block);
+	double sum = 0;
+	double t[2];
+	for (int b=0; b<2; ++b) {
+		double t0 = Now();
+		for (int r=0; r<reps; ++r) {
+			const BenchPoint& q = v[r%v.size()];
+			for (std::size_t i=0; i<n; i+=block) {
+				if (b) K::eval(&v[i], block, q, &out[0]);
+				else K::eval_scalar(&v[i], block, q, &out[0]);
+				sum += out[block-1];
+			}
+		}
+		t[b] = (Now()-t0)*1e9/(double(reps)*n);
+	}
+	std::cout << std::setw(10) << block
+	          << std::setw(12) << std::fixed << std::setprecision(3) << t[0]
+	          << std::setw(12) << t[1]
+	          << std::setw(12) << std::setprecision(2) << t[0]/t[1]
+	          << ((sum < 0) ? " " : "") << std::endl;
+}
+
+/**
+* Zorder : time the z-order kernels, ns per call on points in cache
+*
+* @param v
+*   BenchVec points, the first few thousand used
+*
+* @return
+*   none
+*/
+void Zorder(BenchVec& v)
+{
+	typedef zorder_key<BenchPoint> Z;
+	const std::size_t n = std::min<std::size_t>(v.size(), 4096);
+	const int reps = 2000;
+	zorder_lt<BenchPoint> lt;
+	Z::key_type key;
+	unsigned long int e[2];
+	double sum = 0;
+	double t[4];
+	for (int b=0; b<4; ++b) {
+		double t0 = Now();
+		for (int r=0; r<reps; ++r) {
+			for (std::size_t i=0; i+2<n; ++i) {
+				switch (b) {
+				case 0:
+					sum += lt(v[i], v[i+1]);
+					break;
+				case 1:
+					sum += lt.dist_sq_to_quad_box(v[i], v[i+1], v[i+2]);
+					break;
+				case 2:
+					Z::make(v[i], key);
+					sum += key[0];
+					break;
+				default:
+					e[0] = Z::coord::encode(v[i][0]);
+					e[1] = Z::coord::encode(v[i][1]);
+					Z::interleave_table(e, key);
+					sum += key[0];
+				}
+			}
+		}
+		t[b] = (Now()-t0)*1e9/(double(reps)*(n-2));
+	}
+	std::cout << std::setw(10) << "lt" << std::setw(12) << std::fixed << std::setprecision(3) << t[0] << std::endl
+	          << std::setw(10) << "quadbox" << std::setw(12) << t[1] << std::endl
+	          << std::setw(10) << Z::interleave_name() << std::setw(12) << t[2] << std::endl
+	          << std::setw(10) << "table" << std::setw(12) << t[3]
+	          << ((sum < 0) ? " " : "") << std::endl;
+}
+
+/**
+* Run : build one index and query it, print one result line
+*
+* @param name
+*   std::string label of the configuration
+*
+* @param v
+*   BenchVec points
+*
+* @param q
+*   BenchVec query points
+*
+* @param k
+*   unsigned int no of neighbours
+*
+* @param opts
+*   sfc_options index options
+*
+* @return
+*   none
+*/
+void Run(const std::string& name, BenchVec& v, BenchVec& q, unsigned int k, const sfc_options& opts)
+{
+	sfcdata_work<BenchPoint> NN;
+	BenchArr a(v.size());
+	for (std::size_t i=0; i<v.size(); ++i) {
+		a[i][0] = v[i][0];
+		a[i][1] = v[i][1];
+	}
+	double t0 = Now();
+	NN.sfcnn_do_init(a, opts);
+	double t1 = Now();
+	std::vector<long unsigned int> idx;
+	std::vector<double> dist;
+	double visited = 0;
+	for (std::size_t i=0; i<q.size(); ++i) {
+		sfc_budget budget;
+		NN.ksearch(q[i], k, idx, dist, 0, &budget);
+		visited += budget.visited;
+	}
+	double t2 = Now();
+	std::cout << std::setw(10) << name
+	          << std::setw(12) << std::fixed << std::setprecision(3) << (t1-t0)
+	          << std::setw(12) << std::setprecision(2) << (t2-t1)*1e6/q.size()
+	          << std::setw(12) << std::setprecision(1) << visited/q.size()
+	          << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	std::size_t n = (argc>1) ? atol(argv[1]) : 1000000;
+	std::size_t m = (argc>2) ? atol(argv[2]) : 100000;
+	unsigned int k = (argc>3) ? atoi(argv[3]) : 10;
+	if (n==0 || m==0 || k==0 || k>n) {
+		std::cerr << "usage: " << argv[0] << " [points] [queries] [k]" << std::endl;
+		return 1;
+	}
+
+	{
+		srand(1);
+		BenchVec v(n), centre;
+		Fill(v, centre);
+		std::cout << "kernel " << sqr_dist_block<BenchPoint>::name() << std::endl;
+		std::cout << std::setw(10) << "block" << std::setw(12) << "scalar ns"
+		          << std::setw(12) << "block ns" << std::setw(12) << "speedup" << std::endl;
+		for (unsigned int block=4; block<=64; block*=2)
+			Kernel(v, block);
+		std::cout << std::setw(10) << "zorder" << std::setw(12) << "ns" << std::endl;
+		Zorder(v);
+	}
+
+	for (int clustered=0; clustered<2; ++clustered) {
+		srand(1);
+		// queries come from the same distribution as the points
+		BenchVec v(n), q(m), centre(clustered ? 16 : 0);
+		for (std::size_t c=0; c<centre.size(); ++c) {
+			centre[c][0] = rand()%100000000;
+			centre[c][1] = rand()%100000000;
+		}
+		Fill(v, centre);
+		Fill(q, centre);
+		std::cout << (clustered ? "clustered" : "uniform") << " points=" << n << " queries=" << m << " k=" << k << std::endl;
+		std::cout << std::setw(10) << "curve" << std::setw(12) << "build s"
+		          << std::setw(12) << "query us" << std::setw(12) << "visited" << std::endl;
+
+		sfc_options opts;
+		Run("morton", v, q, k, opts);
+		opts.keys = true;
+		Run("mortonkey", v, q, k, opts);
+		opts.curve = sfc_options::hilbert;
+		Run("hilbert", v, q, k, opts);
+		opts = sfc_options();
+		opts.leaf = 16;
+		Run("morton/16", v, q, k, opts);
+		opts.leaf = 32;
+		Run("morton/32", v, q, k, opts);
+		opts = sfc_options();
+		opts.prefix = 20;
+		Run("prefix", v, q, k, opts);
+		opts = sfc_options();
+		opts.hot = 16;
+		Run("hot", v, q, k, opts);
+		opts = sfc_options();
+		opts.boxes = 64;
+		Run("boxes/64", v, q, k, opts);
+	}
+	return 0;
+}
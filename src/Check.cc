@@ -0,0 +1,309 @@
+/**
+* @project dishante
+* @file src/Check.cc
+* @author  S Roychowdhury <sroycode AT gmail DOT com>
+* @version 1.0
+*
+* @section LICENSE
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* General Public License for more details at
+* http://www.gnu.org/copyleft/gpl.html
+*
+* @section DESCRIPTION
+*
+* Check of the updates of an index against brute force: random points are
+* inserted and deleted on a locked index with a small delta buffer, so that
+* it compacts in the background while it is searched, and every few updates
+* nearest, radius and window searches, with and without a filter on the
+* attributes and a level, are compared with a scan of the points that should
+* be live.  One line per index setup, exits 1 if any search differs.
+*
+* usage: dshcheck [points] [updates] [seed]
+*
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <dsh/PointData.hpp>
+
+typedef std::vector<std::string> CheckAttr;
+typedef dsh::PointData<long int, CheckAttr, 2> CheckData;
+typedef CheckData::Point CheckPoint;
+typedef std::vector<CheckData::OutT> CheckOut;
+
+/** fields of a point, the level and name are searched on */
+enum { GID=0, LEVEL=1, NAME=2 };
+
+/**
+* CheckPt : a point as the brute force keeps it
+*/
+struct CheckPt {
+	CheckPoint P;
+	CheckAttr A;
+};
+typedef std::map<std::string, CheckPt> CheckMap;
+
+/**
+* GidMatch : deletes the point of a gid
+*/
+struct GidMatch {
+	GidMatch(const std::string& gid) : gid_(gid) {}
+	bool operator()(const CheckData::RowT& r) const {
+		return r[GID]==gid_;
+	}
+	std::string gid_;
+};
+
+/**
+* WindowOut : collects the gids a window search visits
+*/
+struct WindowOut {
+	bool operator()(long unsigned int, double, const CheckData::RowT& r) {
+		gids.push_back(r[GID].str());
+		return true;
+	}
+	std::vector<std::string> gids;
+};
+
+/**
+* Random : random coordinate
+*/
+long int Random()
+{
+	return rand()%1000000;
+}
+
+/**
+* Make : a new point of a gid
+*
+* @param gid
+*   long no of the point
+*
+* @return
+*   CheckPt
+*/
+CheckPt Make(long gid)
+{
+	CheckPt p;
+	p.P[0] = Random();
+	p.P[1] = Random();
+	std::ostringstream g, l, n;
+	g << gid;
+	l << (1 + rand()%5);
+	n << "n" << rand()%8;
+	p.A.push_back(g.str());
+	p.A.push_back(l.str());
+	p.A.push_back(n.str());
+	return p;
+}
+
+/**
+* Dist : distance as the index returns it
+*/
+double Dist(const CheckPoint& a, const CheckPoint& b)
+{
+	double d = 0;
+	for (unsigned int j=0; j<2; ++j) {
+		double t = double(a[j]) - double(b[j]);
+		d += t*t;
+	}
+	return ceil(sqrt(d));
+}
+
+/**
+* Pass : true if a point passes the filter and level of a search
+*/
+bool Pass(const CheckPt& p, const dsh::attr_where* where, const long* level)
+{
+	if (level && atol(p.A[LEVEL].c_str()) > *level) return false;
+	if (!where) return true;
+	for (std::size_t k=0; k<where->size(); ++k) {
+		const std::vector<std::string>& v = (*where)[k].second;
+		if (std::find(v.begin(), v.end(), p.A[(*where)[k].first])==v.end()) return false;
+	}
+	return true;
+}
+
+/**
+* Rows : true if every point found is live, passes and is where it is said to be
+*/
+bool Rows(const CheckOut& out, const CheckMap& live, const CheckPoint& Q, const dsh::attr_where* where, const long* level)
+{
+	for (std::size_t i=0; i<out.size(); ++i) {
+		CheckMap::const_iterator it = live.find(out[i].get<2>()[GID].str());
+		if (it==live.end() || !Pass(it->second, where, level)) return false;
+		if (Dist(it->second.P, Q)!=out[i].get<1>()) return false;
+	}
+	return true;
+}
+
+/**
+* Run : update and search one index, print one result line
+*
+* @param name
+*   std::string label of the setup
+*
+* @param opts
+*   sfc_options index options
+*
+* @param n
+*   std::size_t no of points loaded
+*
+* @param updates
+*   std::size_t no of insertions and deletions
+*
+* @return
+*   long no of searches that differ from brute force
+*/
+long Run(const std::string& name, const sfc_options& opts, std::size_t n, std::size_t updates)
+{
+	dsh::point_options popts;
+	popts.dict = 16;
+	popts.level = LEVEL;
+	popts.delta = 64;
+	CheckData::pointer pd = CheckData::create(opts, popts);
+	CheckMap live;
+	std::vector<std::string> gids;
+	long next = 0;
+	for (std::size_t i=0; i<n; ++i, ++next) {
+		CheckPt p = Make(next);
+		pd->Add(p.P, p.A);
+		live[p.A[GID]] = p;
+		gids.push_back(p.A[GID]);
+	}
+	pd->Lock();
+
+	long bad = 0, searches = 0;
+	for (std::size_t u=0; u<updates; ++u) {
+		if (rand()%2 || live.size() < n/2) {
+			CheckPt p = Make(next++);
+			pd->Add(p.P, p.A);
+			live[p.A[GID]] = p;
+			gids.push_back(p.A[GID]);
+		} else {
+			/** gids of deleted points stay in gids, deleting one again finds nothing */
+			std::string gid = gids[rand()%gids.size()];
+			CheckMap::iterator it = live.find(gid);
+			CheckPoint P;
+			P[0] = Random();
+			P[1] = Random();
+			if (it!=live.end()) P = it->second.P;
+			unsigned int k = pd->RemoveAt(P, GidMatch(gid));
+			if (k != ((it!=live.end()) ? 1U : 0U)) ++bad;
+			if (it!=live.end()) live.erase(it);
+		}
+		if (u%10) continue;
+
+		CheckPoint Q;
+		Q[0] = Random();
+		Q[1] = Random();
+		dsh::attr_where w(1);
+		w[0].first = NAME;
+		w[0].second.push_back("n1");
+		w[0].second.push_back("n5");
+		const dsh::attr_where* where = (rand()%2) ? &w : 0;
+		long lv = 1 + rand()%5;
+		const long* level = (rand()%2) ? &lv : 0;
+
+		std::vector<double> all;
+		std::vector<std::string> inside;
+		const long radius = 30000 + rand()%50000;
+		CheckPoint L, U;
+		L[0] = Random();
+		L[1] = Random();
+		U[0] = L[0] + rand()%100000;
+		U[1] = L[1] + rand()%100000;
+		for (CheckMap::const_iterator it=live.begin(); it!=live.end(); ++it) {
+			if (!Pass(it->second, where, level)) continue;
+			all.push_back(Dist(it->second.P, Q));
+			const CheckPoint& P = it->second.P;
+			if (L[0]<=P[0] && P[0]<=U[0] && L[1]<=P[1] && P[1]<=U[1]) inside.push_back(it->first);
+		}
+		std::sort(all.begin(), all.end());
+		std::sort(inside.begin(), inside.end());
+
+		unsigned int k = 1 + rand()%20;
+		CheckOut out = pd->GetNN<CheckOut>(Q, k, 0, where, level);
+		std::vector<double> d;
+		for (std::size_t i=0; i<out.size(); ++i) d.push_back(out[i].get<1>());
+		std::vector<double> want(all.begin(), all.begin() + std::min<std::size_t>(k, all.size()));
+		if (d!=want || !Rows(out, live, Q, where, level)) ++bad;
+
+		/** the ceiled distance of a point just outside may be the radius, so count exactly */
+		std::size_t in = 0;
+		for (CheckMap::const_iterator it=live.begin(); it!=live.end(); ++it) {
+			double dx = double(it->second.P[0] - Q[0]), dy = double(it->second.P[1] - Q[1]);
+			if (Pass(it->second, where, level) && dx*dx + dy*dy <= double(radius)*double(radius)) ++in;
+		}
+		out = pd->GetRange<CheckOut>(Q, radius, 0, where, level);
+		if (out.size()!=in || !Rows(out, live, Q, where, level)) ++bad;
+		/** a cap above the hits, as the server's maxresults, returns them all */
+		out = pd->GetRange<CheckOut>(Q, radius, in+1+rand()%1000, where, level);
+		if (out.size()!=in || !Rows(out, live, Q, where, level)) ++bad;
+		out = pd->GetRange<CheckOut>(Q, radius, 3, where, level);
+		d.clear();
+		for (std::size_t i=0; i<out.size(); ++i) d.push_back(out[i].get<1>());
+		want.assign(all.begin(), all.begin() + std::min<std::size_t>(3, in));
+		if (d!=want || !Rows(out, live, Q, where, level)) ++bad;
+
+		WindowOut wo;
+		pd->GetWindow(L, U, 0, wo, where, level);
+		std::sort(wo.gids.begin(), wo.gids.end());
+		if (wo.gids!=inside) ++bad;
+		searches += 5;
+	}
+	std::cout << std::setw(12) << name
+	          << std::setw(10) << live.size()
+	          << std::setw(10) << updates
+	          << std::setw(10) << searches
+	          << std::setw(10) << bad << std::endl;
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	std::size_t n = (argc>1) ? atol(argv[1]) : 20000;
+	std::size_t updates = (argc>2) ? atol(argv[2]) : 5000;
+	unsigned int seed = (argc>3) ? atoi(argv[3]) : 1;
+	if (n==0) {
+		std::cerr << "usage: " << argv[0] << " [points] [updates] [seed]" << std::endl;
+		return 1;
+	}
+	srand(seed);
+	std::cout << std::setw(12) << "index" << std::setw(10) << "points" << std::setw(10) << "updates"
+	          << std::setw(10) << "searches" << std::setw(10) << "bad" << std::endl;
+	long bad = 0;
+	sfc_options opts;
+	bad += Run("morton", opts, n, updates);
+	opts.keys = true;
+	bad += Run("mortonkey", opts, n, updates);
+	opts.curve = sfc_options::hilbert;
+	bad += Run("hilbert", opts, n, updates);
+	opts.hot = 16;
+	bad += Run("hot", opts, n, updates);
+	opts = sfc_options();
+	opts.permute = true;
+	bad += Run("permute", opts, n, updates);
+	opts.quantize = true;
+	bad += Run("quantize", opts, n, updates);
+	opts.boxes = 64;
+	opts.prefix = 12;
+	opts.hot = 16;
+	bad += Run("boxes", opts, n, updates);
+	return (bad>0) ? 1 : 0;
+}
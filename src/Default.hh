@@ -29,12 +29,14 @@
 #define DSHN_DEFAULT_PORT 9999
 #define DSHN_DEFAULT_HTTP_THREADS 3
 #define DSHN_DEFAULT_JOBQ_THREADS 3
+#define DSHN_DEFAULT_MAXRESULTS 10000
 #define DSHN_DEFAULT_TEMPDIR "."
 #define DSHN_DEFAULT_STRN_DIRSEP "/"
 #define DSHN_DEFAULT_STRN_UNDERSCORE "_"
 #define DSHN_DEFAULT_STRN_DOT "."
 #define DSHN_DEFAULT_HTTP_ADDRESS "127.0.0.1"
 
+/** coordinate type of indexes without a coordtype, float or double indexes are fast with sfckeys=1 */
 #ifndef DSHN_DEFAULT_COORDT
 #define DSHN_DEFAULT_COORDT long int
 #endif
@@ -70,7 +72,52 @@
 #define DSHN_DEFAULT_STRN_X "x"
 #define DSHN_DEFAULT_STRN_Y "y"
 #define DSHN_DEFAULT_STRN_Z "z"
+#define DSHN_DEFAULT_STRN_X2 "x2"
+#define DSHN_DEFAULT_STRN_Y2 "y2"
+#define DSHN_DEFAULT_STRN_Z2 "z2"
 #define DSHN_DEFAULT_STRN_NO "no"
+#define DSHN_DEFAULT_STRN_MAXRESULTS "maxresults"
+#define DSHN_DEFAULT_STRN_RADIUS "radius"
+#define DSHN_DEFAULT_STRN_MAXVISIT "maxvisit"
+#define DSHN_DEFAULT_STRN_MAXTIME "maxtime"
+#define DSHN_DEFAULT_STRN_EXACT_HEADER "X-Dsh-Exact"
+#define DSHN_DEFAULT_STRN_OP "op"
+#define DSHN_DEFAULT_VAL_OP_ADD "add"
+#define DSHN_DEFAULT_VAL_OP_DEL "del"
+#define DSHN_DEFAULT_VAL_OP_RELOAD "reload"
+#define DSHN_DEFAULT_STRN_RELOADOP "reloadop"
+#define DSHN_DEFAULT_STRN_UPDATEOP "updateop"
+#define DSHN_DEFAULT_VAL_OP_CTYPE "text/plain"
+#define DSHN_DEFAULT_STRN_PTS "pts"
+#define DSHN_DEFAULT_STRN_PTS_SEPARATOR ";"
+#define DSHN_DEFAULT_STRN_PTS_COORD_SEPARATOR ","
+#define DSHN_DEFAULT_STRN_LEVEL "level"
+#define DSHN_DEFAULT_STRN_FILTER "filter"
+#define DSHN_DEFAULT_STRN_FILTER_SEPARATOR ";"
+#define DSHN_DEFAULT_STRN_FILTER_FIELD_SEPARATOR ":"
+#define DSHN_DEFAULT_STRN_FILTER_VALUE_SEPARATOR "|"
+
+#define DSHN_DEFAULT_STRN_SFCKEYS "sfckeys"
+#define DSHN_DEFAULT_STRN_BUILDTHREADS "buildthreads"
+#define DSHN_DEFAULT_STRN_CURVE "curve"
+#define DSHN_DEFAULT_VAL_CURVE_MORTON "morton"
+#define DSHN_DEFAULT_VAL_CURVE_HILBERT "hilbert"
+#define DSHN_DEFAULT_STRN_LEAFSIZE "leafsize"
+#define DSHN_DEFAULT_STRN_PREFIXBITS "prefixbits"
+#define DSHN_DEFAULT_STRN_HOTLEVELS "hotlevels"
+#define DSHN_DEFAULT_STRN_BOXSIZE "boxsize"
+#define DSHN_DEFAULT_STRN_DELTASIZE "deltasize"
+#define DSHN_DEFAULT_STRN_QUANTIZE "quantize"
+#define DSHN_DEFAULT_STRN_PERMUTE "permute"
+#define DSHN_DEFAULT_STRN_DICTSIZE "dictsize"
+#define DSHN_DEFAULT_STRN_LEVELFIELD "levelfield"
+#define DSHN_DEFAULT_STRN_GEO "geo"
+#define DSHN_DEFAULT_STRN_COORDTYPE "coordtype"
+#define DSHN_DEFAULT_VAL_COORDTYPE_INT32 "int32"
+#define DSHN_DEFAULT_VAL_COORDTYPE_INT64 "int64"
+#define DSHN_DEFAULT_VAL_COORDTYPE_UINT32 "uint32"
+#define DSHN_DEFAULT_VAL_COORDTYPE_FLOAT "float"
+#define DSHN_DEFAULT_VAL_COORDTYPE_DOUBLE "double"
 
 #define DSHN_DEFAULT_STRN_TEMPDIR "tempdir"
 #define DSHN_DEFAULT_VAL_TEMPDIR "."
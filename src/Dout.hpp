@@ -57,7 +57,7 @@ public:
 	* @return
 	*   none
 	*/
-	Dout(T& invec) : invec_(invec) {}
+	Dout(T& invec) : invec_(invec), fcode_(0), rows_(0) {}
 
 	/**
 	* virtual destructor
@@ -85,60 +85,242 @@ public:
 	*/
 	bool Parse(std::string format, R& res, std::string& content_type, std::string& result) {
 		bool status=false;
-
-		unsigned int fcode = 0;
-		std::transform(format.begin(), format.end(), format.begin(), ::tolower);
-		for (mime_type_mapping* m = mime_type_mappings; m->type; ++m) {
-			if (m->type == format) {
-				content_type=std::string(m->ctype);
-				fcode=m->ofmt;
-				break;
-			}
+		std::stringstream ss;
+		switch (Format(format, content_type)) {
+		case 1:
+			JsonRows(ss, res);
+			status=true;
+			break;
+		case 2:
+			CsvHeader(ss, false);
+			CsvRows(ss, res, "");
+			status=true;
+			break;
+		default:
+			break;
 		}
-		// starts
-		switch (fcode) {
-		case 1: {
-			std::stringstream ss;
+		if (status) result=ss.str();
+		return status;
+	}
+
+	/**
+	* ParseBatch : parse and populate values for many queries
+	*
+	* @param format
+	*   std::string input format
+	*
+	* @param inres
+	*   std::vector<R> one result container per query, in query order
+	*   	json gives an array of result arrays, csv prefixes each row with the query no
+	*
+	* @param content_type
+	*   std::string content type by address
+	*
+	* @param result
+	*   std::string result by address
+	*
+	* @return
+	*   bool status
+	*/
+	bool ParseBatch(std::string format, std::vector<R>& res, std::string& content_type, std::string& result) {
+		bool status=false;
+		std::stringstream ss;
+		switch (Format(format, content_type)) {
+		case 1:
 			ss << "[";
-			for (std::size_t i=0; i<res.size(); ++i) {
-				if (i>0) ss << ",";
-				ss << "{\"dist\":" << res[i].template get<1>();
-				for (std::size_t j=0; j<res[i].template get<2>().size(); ++j) {
-					ss << ",\"" << invec_[j] << "\":\"" << res[i].template get<2>()[j] << "\"" ;
-				}
-				ss << "}";
+			for (std::size_t q=0; q<res.size(); ++q) {
+				if (q>0) ss << ",";
+				JsonRows(ss, res[q]);
 			}
 			ss << "]";
 			status=true;
-			result=ss.str();
-		}
-		break;
-		case 2: {
-			std::stringstream ss;
-			ss << "dist";
-			for (std::size_t j=0; j<invec_.size(); ++j) {
-				ss << "," << invec_[j];
-			}
-			ss << std::endl;
-			for (std::size_t i=0; i<res.size(); ++i) {
-				ss << res[i].template get<1>();
-				for (std::size_t j=0; j<res[i].template get<2>().size(); ++j) {
-					ss << "," << res[i].template get<2>()[j];
-				}
-				ss << std::endl;
+			break;
+		case 2:
+			CsvHeader(ss, true);
+			for (std::size_t q=0; q<res.size(); ++q) {
+				std::stringstream qs;
+				qs << q << ",";
+				CsvRows(ss, res[q], qs.str());
 			}
 			status=true;
-			result=ss.str();
-		}
 			break;
 		default:
 			break;
 		}
+		if (status) result=ss.str();
 		return status;
 	}
 
+	/**
+	* Begin : start a streamed result, rows are added one at a time with Row
+	*
+	* @param format
+	*   std::string input format
+	*
+	* @param content_type
+	*   std::string content type by address
+	*
+	* @return
+	*   bool status
+	*/
+	bool Begin(std::string format, std::string& content_type) {
+		stream_.str("");
+		rows_=0;
+		fcode_=Format(format, content_type);
+		switch (fcode_) {
+		case 1:
+			stream_ << "[";
+			return true;
+		case 2:
+			CsvHeader(stream_, false);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/**
+	* Row : add one row to a streamed result
+	*
+	* @param dist
+	*   double distance
+	*
+	* @param attrs
+	*   A fields in same order as invec
+	*
+	* @return
+	*   none
+	*/
+	template<class A>
+	void Row(double dist, const A& attrs) {
+		switch (fcode_) {
+		case 1:
+			if (rows_>0) stream_ << ",";
+			JsonRow(stream_, dist, attrs);
+			break;
+		case 2:
+			CsvRow(stream_, dist, attrs, "");
+			break;
+		default:
+			return;
+		}
+		++rows_;
+	}
+
+	/**
+	* operator() : add one row to a streamed result, as a search visitor
+	*
+	* @return
+	*   bool true to continue
+	*/
+	template<class A>
+	bool operator()(long unsigned int, double dist, const A& attrs) {
+		Row(dist, attrs);
+		return true;
+	}
+
+	/**
+	* End : finish a streamed result
+	*
+	* @param result
+	*   std::string result by address
+	*
+	* @return
+	*   none
+	*/
+	void End(std::string& result) {
+		if (fcode_==1) stream_ << "]";
+		result=stream_.str();
+		stream_.str("");
+	}
+
 private:
 	sVec invec_;
+	std::stringstream stream_;
+	unsigned int fcode_;
+	std::size_t rows_;
+
+	/**
+	* Format : get the format code and content type
+	*
+	* @param format
+	*   std::string input format
+	*
+	* @param content_type
+	*   std::string content type by address
+	*
+	* @return
+	*   unsigned int format code, 0 if unknown
+	*/
+	unsigned int Format(std::string format, std::string& content_type) {
+		unsigned int fcode = 0;
+		std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+		for (mime_type_mapping* m = mime_type_mappings; m->type; ++m) {
+			if (m->type == format) {
+				content_type=std::string(m->ctype);
+				fcode=m->ofmt;
+				break;
+			}
+		}
+		return fcode;
+	}
+
+	/**
+	* JsonRows : write one result container as a json array
+	*/
+	void JsonRows(std::stringstream& ss, R& res) {
+		ss << "[";
+		for (std::size_t i=0; i<res.size(); ++i) {
+			if (i>0) ss << ",";
+			JsonRow(ss, res[i].template get<1>(), res[i].template get<2>());
+		}
+		ss << "]";
+	}
+
+	/**
+	* JsonRow : write one result as a json object
+	*/
+	template<class A>
+	void JsonRow(std::stringstream& ss, double dist, const A& attrs) {
+		ss << "{\"dist\":" << dist;
+		for (std::size_t j=0; j<attrs.size(); ++j) {
+			ss << ",\"" << invec_[j] << "\":\"" << attrs[j] << "\"" ;
+		}
+		ss << "}";
+	}
+
+	/**
+	* CsvHeader : write the csv header line, with query no column if batch
+	*/
+	void CsvHeader(std::stringstream& ss, bool batch) {
+		if (batch) ss << "qno,";
+		ss << "dist";
+		for (std::size_t j=0; j<invec_.size(); ++j) {
+			ss << "," << invec_[j];
+		}
+		ss << std::endl;
+	}
+
+	/**
+	* CsvRows : write one result container as csv lines with a prefix
+	*/
+	void CsvRows(std::stringstream& ss, R& res, const std::string& prefix) {
+		for (std::size_t i=0; i<res.size(); ++i) {
+			CsvRow(ss, res[i].template get<1>(), res[i].template get<2>(), prefix);
+		}
+	}
+
+	/**
+	* CsvRow : write one result as a csv line with a prefix
+	*/
+	template<class A>
+	void CsvRow(std::stringstream& ss, double dist, const A& attrs, const std::string& prefix) {
+		ss << prefix << dist;
+		for (std::size_t j=0; j<attrs.size(); ++j) {
+			ss << "," << attrs[j];
+		}
+		ss << std::endl;
+	}
 };
 }
 #endif /* _DSHN_DOUT_HPP_ */
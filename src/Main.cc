@@ -24,7 +24,10 @@
 */
 
 #include <iostream>
+#include <csignal>
+#include <pthread.h>
 #include <boost/assign/list_of.hpp>
+#include <boost/thread/thread.hpp>
 #include <apn/CmdLineOptions.hpp>
 #include <apn/CfgFileOptions.hpp>
 #include <apn/ConnServ.hpp>
@@ -51,6 +54,21 @@ T FindInSystem(const std::string s, T defval)
 	return p;
 }
 
+/** SIGHUP rebuilds all indexes while serving */
+void WaitHup(dshn::Work::pointer Sdata, sigset_t hup)
+{
+	for (;;) {
+		int sig=0;
+		if (sigwait(&hup, &sig)!=0 || sig!=SIGHUP) continue;
+		std::cerr << "SIGHUP, reloading" << std::endl;
+		try {
+			if (!Sdata->reload("")) std::cerr << "Reload already running" << std::endl;
+		} catch(const apn::GenericException& e) {
+			std::cerr << e.ErrorCode_ << " " << e.ErrorMsg_ << " " << e.ErrorFor_ << std::endl;
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -68,8 +86,14 @@ int main(int argc, char *argv[])
 		int port = FindInSystem<int>(DSHN_DEFAULT_STRN_PORT,DSHN_DEFAULT_PORT);
 		int threads = FindInSystem<int>(DSHN_DEFAULT_STRN_THREADS,DSHN_DEFAULT_HTTP_THREADS);
 		std::string address = FindInSystem<std::string>(DSHN_DEFAULT_STRN_ADDRESS,DSHN_DEFAULT_HTTP_ADDRESS);
+		/** signals: SIGHUP is blocked in all threads and taken by sigwait */
+		sigset_t hup;
+		sigemptyset(&hup);
+		sigaddset(&hup, SIGHUP);
+		pthread_sigmask(SIG_BLOCK, &hup, 0);
 		/**  work */
 		dshn::Work::pointer Sdata = dshn::Work::create(MyCFG);
+		boost::thread hupthread(boost::bind(&WaitHup, Sdata->share(), hup));
 		/** http */
 		apn::ConnServ::pointer cs = apn::ConnServ::create(
 	                                threads, address, apn::Convert::AnyToAny<unsigned int,std::string>(port),
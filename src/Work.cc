@@ -26,9 +26,15 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <boost/assign/list_of.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/ref.hpp>
+#include <boost/cstdint.hpp>
 #include "Work.hpp"
 #include "Dout.hpp"
 #include <apn/ConvertStr.hpp>
@@ -54,83 +60,249 @@
 *   none
 */
 dshn::Work::Work (apn::CfgFileOptions& MyCFG)
-	: params2d(loadparams(MyCFG,false)),
-	  params3d(loadparams(MyCFG,true))
+	: mycfg(MyCFG),
+	  params2d(loadparams(MyCFG,false)),
+	  params3d(loadparams(MyCFG,true)),
+	  reloadop(MyCFG.Find<int>(DSHN_DEFAULT_STRN_SYSTEM, DSHN_DEFAULT_STRN_RELOADOP, true)!=0),
+	  updateop(MyCFG.Find<int>(DSHN_DEFAULT_STRN_SYSTEM, DSHN_DEFAULT_STRN_UPDATEOP, true)!=0),
+	  maxresults(DSHN_DEFAULT_MAXRESULTS),
+	  rebuilding(false)
 {
-	typedef std::pair<std::string,std::string> ssPair;
-	typedef std::vector<ssPair> ssPairVec;
-
+	int maxres = MyCFG.Find<int>(DSHN_DEFAULT_STRN_SYSTEM, DSHN_DEFAULT_STRN_MAXRESULTS, true);
+	if (maxres > 0) maxresults = maxres;
 	sVec S = apn::Convert::StringToList<sVec>(
 	             MyCFG.Find<std::string>(DSHN_DEFAULT_STRN_SYSTEM, DSHN_DEFAULT_STRN_INDEXES),
 	             DSHN_DEFAULT_STRN_INDEXES_SEPARATOR);
 	for (sVec::const_iterator it=S.begin(); it!=S.end(); ++it) {
 		if ( MyCFG.Find<int>(*it, "active",false)==0) continue;
-		bool is3d = MyCFG.Check<DSHN_DEFAULT_COORDT>(*it, DSHN_DEFAULT_STRN_Z);
-		ssPairVec mvec;
-		if (is3d) {
-			for (sVec::const_iterator jt=params3d.begin(); jt!=params3d.end(); ++jt) {
-				mvec.push_back(std::make_pair<std::string,std::string>(*jt,MyCFG.Find<std::string>(*it,*jt)));
-			}
-		} else {
-			for (sVec::const_iterator jt=params2d.begin(); jt!=params2d.end(); ++jt) {
-				mvec.push_back(std::make_pair<std::string,std::string>(*jt,MyCFG.Find<std::string>(*it,*jt)));
-			}
-		}
-		std::string dbtype = MyCFG.Find<std::string>(*it, "dbtype");
+		/** a geo index takes x as the longitude and y as the latitude */
+		bool is3d = (MyCFG.Find<int>(*it, DSHN_DEFAULT_STRN_GEO, true)==0)
+		            && MyCFG.Check<DSHN_DEFAULT_COORDT>(*it, DSHN_DEFAULT_STRN_Z);
+		std::string idx = MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_INDEX);
+		ipMap& m = (is3d) ? pemap : pdmap;
+		ipMap::iterator jt = m.find(idx);
+		if (jt==m.end()) jt = m.insert(std::make_pair(idx, create(*it, is3d))).first;
+		source(*it, is3d, boost::bind(&dshn::Work::addto,jt->second,_1));
+	}
+	for(ipMap::const_iterator jt = pdmap.begin(); jt!=pdmap.end(); ++jt) {
+		jt->second->Lock();
+		std::cerr << "Loaded " << jt->first << " " << jt->second->Dim() << "d" << std::endl;
+	}
+	for(ipMap::const_iterator jt = pemap.begin(); jt!=pemap.end(); ++jt) {
+		jt->second->Lock();
+		std::cerr << "Loaded " << jt->first << " " << jt->second->Dim() << "d" << std::endl;
+	}
+}
 
+/**
+* create: new empty index of a config section, of its coordtype, a geo index if
+* the section is one
+*
+* @param section
+*   std::string config section of the index
+*
+* @param is3d
+*   bool is it 3d
+*
+* @return
+*   IndexT::pointer
+*/
+dshn::Work::IndexT::pointer dshn::Work::create(std::string section, bool is3d)
+{
+	std::string idx = mycfg.Find<std::string>(section,DSHN_DEFAULT_STRN_INDEX);
+	soMap::iterator ot = optmap.find(idx);
+	if (ot==optmap.end()) ot = optmap.insert(std::make_pair(idx, loadopts(mycfg,section))).first;
+	const sfc_options& opts = ot->second;
+	bool geo = (mycfg.Find<int>(section, DSHN_DEFAULT_STRN_GEO, true)!=0);
+	dsh::point_options popts;
+	int dictsize = mycfg.Find<int>(section, DSHN_DEFAULT_STRN_DICTSIZE, true);
+	if (dictsize > 0) popts.dict = dictsize;
+	int delta = mycfg.Find<int>(section, DSHN_DEFAULT_STRN_DELTASIZE, true);
+	if (delta > 0) popts.delta = delta;
+	/** the level field is found by name, its no is that in the fields of the dimension */
+	std::string lf = mycfg.Find<std::string>(section, DSHN_DEFAULT_STRN_LEVELFIELD, true);
+	if (!lf.empty()) {
+		const sVec& params = (is3d) ? params3d : params2d;
+		sVec::const_iterator jt = std::find(params.begin(), params.end(), lf);
+		if (jt==params.end()) throw apn::GenericException(DSHN_WORK_PROGNO,"unknown field",DSHN_DEFAULT_STRN_LEVELFIELD);
+		popts.level = jt-params.begin();
+	}
+	std::string ct = mycfg.Find<std::string>(section, DSHN_DEFAULT_STRN_COORDTYPE, true);
+	if (ct.empty()) return make<DSHN_DEFAULT_COORDT>(opts, popts, is3d, geo);
+	if (ct==DSHN_DEFAULT_VAL_COORDTYPE_INT32) return make<boost::int32_t>(opts, popts, is3d, geo);
+	if (ct==DSHN_DEFAULT_VAL_COORDTYPE_INT64) return make<boost::int64_t>(opts, popts, is3d, geo);
+	if (ct==DSHN_DEFAULT_VAL_COORDTYPE_FLOAT) return make<float>(opts, popts, is3d, geo);
+	if (ct==DSHN_DEFAULT_VAL_COORDTYPE_DOUBLE) return make<double>(opts, popts, is3d, geo);
+	if (ct==DSHN_DEFAULT_VAL_COORDTYPE_UINT32) {
+		/** earth centered coordinates are signed */
+		if (geo) throw apn::GenericException(DSHN_WORK_PROGNO,"not on a geo index",DSHN_DEFAULT_STRN_COORDTYPE);
+		return make<boost::uint32_t>(opts, popts, is3d, geo);
+	}
+	throw apn::GenericException(DSHN_WORK_PROGNO,"unknown value",DSHN_DEFAULT_STRN_COORDTYPE);
+}
+
+/**
+* source: read the data of a config section, this will be passed on
+*
+* @param section
+*   std::string config section of the index
+*
+* @param is3d
+*   bool is it 3d
+*
+* @param sink
+*   SinkT called with the input data of each point
+*
+* @return
+*   none
+*/
+void dshn::Work::source(std::string section, bool is3d, SinkT sink)
+{
+	typedef std::pair<std::string,std::string> ssPair;
+	typedef std::vector<ssPair> ssPairVec;
+
+	apn::CfgFileOptions& MyCFG = mycfg;
+	const sVec& params = (is3d) ? params3d : params2d;
+	ssPairVec mvec;
+	for (sVec::const_iterator jt=params.begin(); jt!=params.end(); ++jt) {
+		mvec.push_back(std::make_pair<std::string,std::string>(*jt,MyCFG.Find<std::string>(section,*jt)));
+	}
+	std::string dbtype = MyCFG.Find<std::string>(section, "dbtype");
 
-		// Database work Begin
+	// Database work Begin
 
-		if (dbtype=="csv") {
-			dsh::db::CsvFile C(
-			    MyCFG.Find<std::string>(*it, DSHN_DEFAULT_STRN_DELIM),
-			    MyCFG.Find<std::string>(*it, DSHN_DEFAULT_STRN_FILENAME)
-			);
-			std::string r = MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_INDEX);
-			C.Process<ssPairVec,sVec>(mvec,boost::bind(&dshn::Work::load,this,r,_1,is3d));
-		} else if (dbtype=="mysql") {
+	if (dbtype=="csv") {
+		dsh::db::CsvFile C(
+		    MyCFG.Find<std::string>(section, DSHN_DEFAULT_STRN_DELIM),
+		    MyCFG.Find<std::string>(section, DSHN_DEFAULT_STRN_FILENAME)
+		);
+		C.Process<ssPairVec,sVec>(mvec,sink);
+	} else if (dbtype=="mysql") {
 #ifdef COMPILE_WITH_MYSQL
-			dsh::db::Mysql C(
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBHOST),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBPORT),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBNAME),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBUSER),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBPASS),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBTABLE),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBWHERE)
-			);
-			std::string r = MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_INDEX);
-			C.Process<ssPairVec,sVec>(mvec,boost::bind(&dshn::Work::load,this,r,_1,is3d));
+		dsh::db::Mysql C(
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBHOST),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBPORT),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBNAME),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBUSER),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBPASS),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBTABLE),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBWHERE)
+		);
+		C.Process<ssPairVec,sVec>(mvec,sink);
 #else
-			throw apn::GenericException(DSHN_WORK_PROGNO,"Unimplemented datasource " , dbtype.c_str());
+		throw apn::GenericException(DSHN_WORK_PROGNO,"Unimplemented datasource " , "mysql");
 #endif
-		} else if (dbtype=="pgsql") {
+	} else if (dbtype=="pgsql") {
 #ifdef COMPILE_WITH_PGSQL
-			dsh::db::Pgsql C(
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBHOST),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBPORT),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBNAME),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBUSER),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBPASS),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBTABLE),
-			    MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_DBWHERE)
-			);
-			std::string r = MyCFG.Find<std::string>(*it,DSHN_DEFAULT_STRN_INDEX);
-			C.Process<ssPairVec,sVec>(mvec,boost::bind(&dshn::Work::load,this,r,_1,is3d));
+		dsh::db::Pgsql C(
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBHOST),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBPORT),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBNAME),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBUSER),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBPASS),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBTABLE),
+		    MyCFG.Find<std::string>(section,DSHN_DEFAULT_STRN_DBWHERE)
+		);
+		C.Process<ssPairVec,sVec>(mvec,sink);
 #else
-			throw apn::GenericException(DSHN_WORK_PROGNO,"Unimplemented datasource " , dbtype.c_str());
+		throw apn::GenericException(DSHN_WORK_PROGNO,"Unimplemented datasource " , "pgsql");
 #endif
-		} else {
-			throw apn::GenericException(DSHN_WORK_PROGNO,"Undefined datasource: " , dbtype.c_str());
-		}
-		// Database work End
+	} else {
+		throw apn::GenericException(DSHN_WORK_PROGNO,"Undefined datasource: " , "dbtype");
 	}
-	for(sp2Map::const_iterator jt = pdmap.begin(); jt!=pdmap.end(); ++jt) {
-		jt->second->Lock();
+	// Database work End
+}
+
+/**
+* reload: rebuild indexes from their data sources on a background thread, each is
+* swapped in when built while searches go on with the old one
+*
+* @param index
+*   std::string Index to rebuild, all if empty
+*
+* @return
+*   Bool false if a rebuild is already running
+*/
+bool dshn::Work::reload(std::string index)
+{
+	if (!index.empty() && pdmap.find(index)==pdmap.end() && pemap.find(index)==pemap.end())
+		throw apn::GenericException(DSHN_WORK_PROGNO,"no index",index.c_str());
+	boost::mutex::scoped_lock lock(rebuildmutex);
+	if (rebuilding) return false;
+	rebuilding=true;
+	if (!rebuildq) rebuildq = apn::InThreadQueue::create(1, boost::bind(&dshn::Work::rebuild,this,_1));
+	rebuildq->Push(boost::make_tuple(boost::posix_time::second_clock::local_time(), index, 0U));
+	return true;
+}
+
+/**
+* rebuild: build indexes afresh and swap them in one after the other, so that
+* only one extra copy of an index is held at a time, always on the same thread
+* so that each build reuses the memory freed by the last
+*
+* @param j
+*   apn::InThreadQueue::JobType job with the Index to rebuild, all if empty
+*
+* @return
+*   none
+*/
+void dshn::Work::rebuild(apn::InThreadQueue::JobType j)
+{
+	std::set<std::string> indexes;
+	if (!j.get<1>().empty()) {
+		indexes.insert(j.get<1>());
+	} else {
+		for(ipMap::const_iterator jt = pdmap.begin(); jt!=pdmap.end(); ++jt) indexes.insert(jt->first);
+		for(ipMap::const_iterator jt = pemap.begin(); jt!=pemap.end(); ++jt) indexes.insert(jt->first);
 	}
-	for(sp3Map::const_iterator jt = pemap.begin(); jt!=pemap.end(); ++jt) {
-		jt->second->Lock();
+	sVec S = apn::Convert::StringToList<sVec>(
+	             mycfg.Find<std::string>(DSHN_DEFAULT_STRN_SYSTEM, DSHN_DEFAULT_STRN_INDEXES),
+	             DSHN_DEFAULT_STRN_INDEXES_SEPARATOR);
+	for (std::set<std::string>::const_iterator xt=indexes.begin(); xt!=indexes.end(); ++xt) {
+		try {
+			ipMap::iterator dt = pdmap.find(*xt);
+			ipMap::iterator et = pemap.find(*xt);
+			IndexT::pointer p2, p3;
+			/** updates from here on would go to the old index, they are refused till the swap */
+			{
+				boost::unique_lock<boost::shared_mutex> ulock(updatemutex);
+				boost::mutex::scoped_lock lock(rebuildmutex);
+				rebuildset.insert(*xt);
+			}
+			for (sVec::const_iterator it=S.begin(); it!=S.end(); ++it) {
+				if (mycfg.Find<int>(*it, "active",false)==0) continue;
+				if (mycfg.Find<std::string>(*it,DSHN_DEFAULT_STRN_INDEX)!=*xt) continue;
+				bool is3d = (mycfg.Find<int>(*it, DSHN_DEFAULT_STRN_GEO, true)==0)
+				            && mycfg.Check<DSHN_DEFAULT_COORDT>(*it, DSHN_DEFAULT_STRN_Z);
+				if (is3d ? (et==pemap.end()) : (dt==pdmap.end())) continue;
+				IndexT::pointer& p = (is3d) ? p3 : p2;
+				if (!p) p = create(*it, is3d);
+				source(*it, is3d, boost::bind(&dshn::Work::addto,p,_1));
+			}
+			/** searches that hold the old index finish on it, the last frees it */
+			if (p2) {
+				p2->Lock();
+				boost::atomic_store(&dt->second, p2);
+			}
+			if (p3) {
+				p3->Lock();
+				boost::atomic_store(&et->second, p3);
+			}
+			std::cerr << "Reloaded " << *xt << std::endl;
+		} catch (apn::GenericException& e) {
+			std::cerr << e.ErrorCode_ << ":" << e.ErrorMsg_ << e.ErrorFor_ << std::endl;
+		} catch (...) {
+			std::cerr << "Unknown Runtime Error" << std::endl;
+		}
+		boost::mutex::scoped_lock lock(rebuildmutex);
+		rebuildset.erase(*xt);
 	}
+#ifdef __GLIBC__
+	/** hand the old indexes back, glibc keeps freed memory of other threads */
+	malloc_trim(0);
+#endif
+	boost::mutex::scoped_lock lock(rebuildmutex);
+	rebuilding=false;
 }
 
 /**
@@ -166,48 +338,41 @@ dshn::Work::sVec dshn::Work::loadparams (apn::CfgFileOptions& MyCFG,bool is3d)
 }
 
 /**
-* load: function for loading, this will be passed on
+* loadopts: function for loading per index sfc options
 *
-* @param index
-*   std::string Index to Load
-*
-* @param Indata
-*   sVec input data object for loading
-*
-* @param is3d
-*   bool if the data is 3d
+* @param MyCFG
+*   apn::CfgFileOptions ConfigFile Options
 *
+* @param section
+*   std::string config section of the index
 *
 * @return
-*   none
+*   sfc_options
 */
-void dshn::Work::load(std::string index, sVec Indata, bool is3d)
+sfc_options dshn::Work::loadopts (apn::CfgFileOptions& MyCFG, std::string section)
 {
-	bool e=false;
-	if (is3d) {
-		sp3Map::iterator it = pemap.find(index);
-		if (it==pemap.end()) {
-			boost::tie(it,e) = pemap.insert(std::make_pair<std::string,PointDataT3d::pointer>(index,PointDataT3d::create()));
-		}
-		PointDataT3d::Point P= {{
-				apn::Convert::AnyToAny<std::string,DSHN_DEFAULT_COORDT>(Indata[1]),	// x
-				apn::Convert::AnyToAny<std::string,DSHN_DEFAULT_COORDT>(Indata[2]),	// y
-				apn::Convert::AnyToAny<std::string,DSHN_DEFAULT_COORDT>(Indata[3])	// z
-			}
-		};
-		it->second->share()->Add(P, Indata);
-	} else {
-		sp2Map::iterator it = pdmap.find(index);
-		if (it==pdmap.end()) {
-			boost::tie(it,e) = pdmap.insert(std::make_pair<std::string,PointDataT2d::pointer>(index,PointDataT2d::create()));
-		}
-		PointDataT2d::Point P= {{
-				apn::Convert::AnyToAny<std::string,DSHN_DEFAULT_COORDT>(Indata[1]),	// x
-				apn::Convert::AnyToAny<std::string,DSHN_DEFAULT_COORDT>(Indata[2])	// y
-			}
-		};
-		it->second->share()->Add(P, Indata);
-	}
+	sfc_options opts;
+	opts.keys = (MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_SFCKEYS, true) != 0);
+	int threads = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_BUILDTHREADS, true);
+	opts.threads = (threads > 0) ? threads : 1;
+	std::string curve = MyCFG.Find<std::string>(section, DSHN_DEFAULT_STRN_CURVE, true);
+	if (curve == DSHN_DEFAULT_VAL_CURVE_HILBERT) opts.curve = sfc_options::hilbert;
+	else if (!curve.empty() && curve != DSHN_DEFAULT_VAL_CURVE_MORTON)
+		throw apn::GenericException(DSHN_WORK_PROGNO,"unknown value",DSHN_DEFAULT_STRN_CURVE);
+	int leaf = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_LEAFSIZE, true);
+	if (leaf > 0) opts.leaf = leaf;
+	int prefix = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_PREFIXBITS, true);
+	if (prefix > 0) opts.prefix = prefix;
+	int hot = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_HOTLEVELS, true);
+	if (hot > 0) opts.hot = hot;
+	int boxes = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_BOXSIZE, true);
+	if (boxes > 0) opts.boxes = boxes;
+	opts.quantize = (MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_QUANTIZE, true) != 0);
+	opts.permute = (MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_PERMUTE, true) != 0);
+	int maxvisit = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_MAXVISIT, true);
+	int maxtime = MyCFG.Find<int>(section, DSHN_DEFAULT_STRN_MAXTIME, true);
+	opts.budget = sfc_budget((maxvisit > 0) ? maxvisit : 0, (maxtime > 0) ? maxtime : 0);
+	return opts;
 }
 
 /**
@@ -228,53 +393,130 @@ bool dshn::Work::run(apn::WebObject::pointer W)
 		boost::tuples::tie(e,index) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_INDEX);
 		if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not defined",DSHN_DEFAULT_STRN_INDEX);
 
-		DSHN_DEFAULT_COORDT x,y,z;
-
-		boost::tuples::tie(e,x) = W->GetReqParam<DSHN_DEFAULT_COORDT>(DSHN_DEFAULT_STRN_X);
-		if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_X);
-
-		boost::tuples::tie(e,y) = W->GetReqParam<DSHN_DEFAULT_COORDT>(DSHN_DEFAULT_STRN_Y);
-		if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_X);
-
-		bool is3d = false;
-		boost::tuples::tie(e,z) = W->GetReqParam<DSHN_DEFAULT_COORDT>(DSHN_DEFAULT_STRN_Z);
-		if (e) is3d=true;
-		/** so we use z to determine dimension, will need to change */
-
 		unsigned int no=1;
 		boost::tuples::tie(e,no) = W->GetReqParam<unsigned int>(DSHN_DEFAULT_STRN_NO);
+		bool hasno = (e && no>0);
 		if (!e) no=1;
+		/** no search returns more than maxresults points, set in the system section */
+		if (no > maxresults) no=maxresults;
 
 		std::string fmt;
 		boost::tuples::tie(e,fmt) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_FMT);
 		if (!e) fmt=DSHN_DEFAULT_VAL_FMT;
 
 		std::string ctype,rstr;
-		if (is3d) {
-			sp3Map::iterator it = pemap.find(index);
-			if (it != pemap.end()) {
-				typedef std::vector<PointDataT3d::OutT> outvecT;
-				PointDataT3d::Point P= {{x,y,z}};
-				outvecT a = it->second->share()->GetNN<outvecT>(P,no);
-				dshn::Dout<sVec,outvecT> d(params3d);
-				status=d.Parse(fmt, a, ctype, rstr);
-			} else {
-				throw apn::GenericException(DSHN_WORK_PROGNO,"no index",index.c_str());
+
+		std::string op;
+		boost::tuples::tie(e,op) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_OP);
+		bool isupdate = e;
+		if (isupdate && op==DSHN_DEFAULT_VAL_OP_RELOAD) {
+			/** a rebuild reads all the data again, only if the system allows it */
+			if (!reloadop) throw apn::GenericException(DSHN_WORK_PROGNO,"not allowed",DSHN_DEFAULT_VAL_OP_RELOAD);
+			rstr = reload(index) ? "1\n" : "0\n";
+			W->SetContentType(DSHN_DEFAULT_VAL_OP_CTYPE);
+			W->AddResponse(rstr.c_str(),rstr.length());
+			return true;
+		}
+
+		/** only points whose fields have the values given are searched for */
+		std::string filter;
+		boost::tuples::tie(e,filter) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_FILTER);
+		if (!e) filter.clear();
+
+		/** on an index with a level field, only points up to the level */
+		long level=0;
+		boost::tuples::tie(e,level) = W->GetReqParam<long>(DSHN_DEFAULT_STRN_LEVEL);
+		const long* lp = (e) ? &level : 0;
+
+		std::string pts;
+		boost::tuples::tie(e,pts) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_PTS);
+		if (e) {
+			status=batch(index, pts, no, fmt, filter, lp, ctype, rstr);
+			if (status) {
+				W->SetContentType(ctype);
+				W->AddResponse(rstr.c_str(),rstr.length());
 			}
-		} else {
-			sp2Map::iterator it = pdmap.find(index);
-			if (it != pdmap.end()) {
-				typedef std::vector<PointDataT2d::OutT> outvecT;
-				PointDataT2d::Point P= {{x,y}};
-				outvecT a = it->second->share()->GetNN<outvecT>(P,no);
-				dshn::Dout<sVec,outvecT> d(params2d);
-				status=d.Parse(fmt, a, ctype, rstr);
-			} else {
-				throw apn::GenericException(DSHN_WORK_PROGNO,"no index",index.c_str());
+			return status;
+		}
+
+		/** coordinates stay text till the index converts them to its own type */
+		IndexT::cVec P(2);
+		bool is3d = false;
+
+		boost::tuples::tie(e,P[0]) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_X);
+		if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_X);
+
+		boost::tuples::tie(e,P[1]) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_Y);
+		if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_Y);
+
+		std::string z;
+		boost::tuples::tie(e,z) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_Z);
+		if (e) {
+			is3d=true;
+			P.push_back(z);
+		}
+		/** so we use z to determine dimension, will need to change */
+
+		if (isupdate) {
+			status=update(index, op, W, is3d, ctype, rstr);
+			if (status) {
+				W->SetContentType(ctype);
+				W->AddResponse(rstr.c_str(),rstr.length());
 			}
+			return status;
+		}
+
+		/** with a radius, no caps the results and is maxresults if not given */
+		double radius=0;
+		boost::tuples::tie(e,radius) = W->GetReqParam<double>(DSHN_DEFAULT_STRN_RADIUS);
+		bool isrange = e;
+		if (isrange && !hasno) no=maxresults;
+
+		/** with an opposite corner x2,y2(,z2) it is a window, capped as above */
+		IndexT::cVec P2(2);
+		boost::tuples::tie(e,P2[0]) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_X2);
+		bool iswindow = e;
+		if (iswindow) {
+			if (!hasno) no=maxresults;
+			boost::tuples::tie(e,P2[1]) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_Y2);
+			if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_Y2);
+			if (is3d) {
+				std::string z2;
+				boost::tuples::tie(e,z2) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_Z2);
+				if (!e) throw apn::GenericException(DSHN_WORK_PROGNO,"param not found",DSHN_DEFAULT_STRN_Z2);
+				P2.push_back(z2);
+			}
+		}
+
+		/** a nearest search stops early on the budget, by default that of the index */
+		soMap::const_iterator oit = optmap.find(index);
+		sfc_budget budget = (oit != optmap.end()) ? oit->second.budget : sfc_budget();
+		long unsigned int maxvisit=0, maxtime=0;
+		boost::tuples::tie(e,maxvisit) = W->GetReqParam<long unsigned int>(DSHN_DEFAULT_STRN_MAXVISIT);
+		if (e) budget.max_visit=maxvisit;
+		boost::tuples::tie(e,maxtime) = W->GetReqParam<long unsigned int>(DSHN_DEFAULT_STRN_MAXTIME);
+		if (e) budget.max_usec=maxtime;
+		bool isnearest = !(iswindow || isrange);
+
+		dsh::attr_where w = where(filter, is3d);
+		const dsh::attr_where* wp = (w.empty()) ? 0 : &w;
+
+		/** on a geo index radius and distances are great circle metres */
+		IndexT::pointer p = current(is3d ? pemap : pdmap, index);
+		dshn::Dout<sVec,IndexT::oVec> d(is3d ? params3d : params2d);
+		if (iswindow) {
+			status=d.Begin(fmt, ctype);
+			if (status) p->GetWindow(P,P2,no,boost::ref(d),wp,lp);
+			d.End(rstr);
+		} else {
+			IndexT::oVec a = (isrange)
+			                 ? p->GetRange(P,radius,no,wp,lp)
+			                 : p->GetNN(P,no,&budget,wp,lp);
+			status=d.Parse(fmt, a, ctype, rstr);
 		}
 		if (status) {
 			W->SetContentType(ctype);
+			if (isnearest) W->SetRespHeader(DSHN_DEFAULT_STRN_EXACT_HEADER, budget.exact ? "1" : "0");
 			W->AddResponse(rstr.c_str(),rstr.length());
 		}
 
@@ -286,3 +528,152 @@ bool dshn::Work::run(apn::WebObject::pointer W)
 	}
 	return status;
 }
+
+/**
+* batch: search many points at once, the dimension is the no of coords per point
+*
+* @param index
+*   std::string Index to search
+*
+* @param pts
+*   std::string points as x,y[,z] separated by ;
+*
+* @param no
+*   unsigned int no of results per point
+*
+* @param fmt
+*   std::string output format
+*
+* @param filter
+*   std::string conditions on the fields of the points, none if empty
+*
+* @param level
+*   long* highest level of the points, none if null
+*
+* @param ctype
+*   std::string content type by address
+*
+* @param rstr
+*   std::string result by address
+*
+* @return
+*   Bool status
+*/
+bool dshn::Work::batch(std::string index, std::string pts, unsigned int no, std::string fmt, std::string filter, const long* level, std::string& ctype, std::string& rstr)
+{
+	sVec S = apn::Convert::StringToList<sVec>(pts, DSHN_DEFAULT_STRN_PTS_SEPARATOR);
+	if (S.empty()) throw apn::GenericException(DSHN_WORK_PROGNO,"no points in",DSHN_DEFAULT_STRN_PTS);
+
+	/** on a geo index the points are longitude,latitude in degrees */
+	std::vector<IndexT::cVec> C;
+	for (sVec::const_iterator it=S.begin(); it!=S.end(); ++it) {
+		C.push_back(apn::Convert::StringToList<IndexT::cVec>(*it, DSHN_DEFAULT_STRN_PTS_COORD_SEPARATOR));
+		if (C.back().size()!=C.front().size())
+			throw apn::GenericException(DSHN_WORK_PROGNO,"mixed dimensions in",DSHN_DEFAULT_STRN_PTS);
+	}
+	if (C.front().size()!=2 && C.front().size()!=3)
+		throw apn::GenericException(DSHN_WORK_PROGNO,"bad dimension in",DSHN_DEFAULT_STRN_PTS);
+
+	bool is3d = (C.front().size()==3);
+	dsh::attr_where w = where(filter, is3d);
+	IndexT::pointer p = current(is3d ? pemap : pdmap, index);
+	std::vector<IndexT::oVec> a = p->GetNNBatch(C,no,w.empty() ? 0 : &w,level);
+	dshn::Dout<sVec,IndexT::oVec> d(is3d ? params3d : params2d);
+	bool status=d.ParseBatch(fmt, a, ctype, rstr);
+	return status;
+}
+
+/**
+* where: the conditions of a filter param, as field:value|value separated by ;
+*
+* @param filter
+*   std::string filter param
+*
+* @param is3d
+*   bool is it 3d, the fields are those of the dimension
+*
+* @return
+*   dsh::attr_where
+*/
+dsh::attr_where dshn::Work::where(std::string filter, bool is3d) const
+{
+	const sVec& params = (is3d) ? params3d : params2d;
+	sVec S = apn::Convert::StringToList<sVec>(filter, DSHN_DEFAULT_STRN_FILTER_SEPARATOR);
+	dsh::attr_where w;
+	for (sVec::const_iterator it=S.begin(); it!=S.end(); ++it) {
+		std::size_t c = it->find(DSHN_DEFAULT_STRN_FILTER_FIELD_SEPARATOR);
+		if (c==std::string::npos)
+			throw apn::GenericException(DSHN_WORK_PROGNO,"no field separator in",DSHN_DEFAULT_STRN_FILTER);
+		sVec::const_iterator jt = std::find(params.begin(), params.end(), it->substr(0,c));
+		if (jt==params.end())
+			throw apn::GenericException(DSHN_WORK_PROGNO,"unknown field in",DSHN_DEFAULT_STRN_FILTER);
+		/** field: with no value matches an empty field */
+		sVec V = apn::Convert::StringToList<sVec>(it->substr(c+1), DSHN_DEFAULT_STRN_FILTER_VALUE_SEPARATOR);
+		if (V.empty()) V.push_back(std::string());
+		w.push_back(std::make_pair(std::size_t(jt-params.begin()), V));
+	}
+	return w;
+}
+
+/**
+* update: insert a point given by its fields, or delete the points at a location
+*
+* @param index
+*   std::string Index to update
+*
+* @param op
+*   std::string add or del
+*
+* @param W
+*   WebObject W with the fields of the point as params
+*
+* @param is3d
+*   bool is it 3d
+*
+* @param ctype
+*   std::string content type by address
+*
+* @param rstr
+*   std::string result by address, the no of points added or deleted
+*
+* @return
+*   Bool status
+*/
+bool dshn::Work::update(std::string index, std::string op, apn::WebObject::pointer W, bool is3d, std::string& ctype, std::string& rstr)
+{
+	bool e=false;
+	/** points are added or deleted only if the system allows it */
+	if (!updateop) throw apn::GenericException(DSHN_WORK_PROGNO,"not allowed",DSHN_DEFAULT_STRN_OP);
+	/** a rebuild waits for updates under way before it starts */
+	boost::shared_lock<boost::shared_mutex> ulock(updatemutex);
+	{
+		boost::mutex::scoped_lock lock(rebuildmutex);
+		if (rebuildset.count(index))
+			throw apn::GenericException(DSHN_WORK_PROGNO,"index rebuilding",index.c_str());
+	}
+	IndexT::pointer p = current(is3d ? pemap : pdmap, index);
+	const sVec& params = (is3d) ? params3d : params2d;
+	sVec Indata(params.size());
+	for (std::size_t j=0; j<params.size(); ++j) {
+		boost::tuples::tie(e,Indata[j]) = W->GetReqParam<std::string>(params[j]);
+	}
+	if (Indata.size() <= p->Dim())
+		throw apn::GenericException(DSHN_WORK_PROGNO,"too few fields"," for a point");
+	IndexT::cVec C(Indata.begin()+1, Indata.begin()+1+p->Dim());
+
+	unsigned int n=0;
+	if (op==DSHN_DEFAULT_VAL_OP_ADD) {
+		/** the index is locked, so add inserts */
+		p->Add(C, Indata);
+		n=1;
+	} else if (op==DSHN_DEFAULT_VAL_OP_DEL) {
+		std::string gid;
+		boost::tuples::tie(e,gid) = W->GetReqParam<std::string>(DSHN_DEFAULT_STRN_GID);
+		n=p->RemoveAt(C, GidMatch(e, gid));
+	} else {
+		throw apn::GenericException(DSHN_WORK_PROGNO,"unknown value",DSHN_DEFAULT_STRN_OP);
+	}
+	ctype=DSHN_DEFAULT_VAL_OP_CTYPE;
+	rstr=apn::Convert::AnyToAny<unsigned int,std::string>(n) + "\n";
+	return true;
+}
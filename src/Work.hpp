@@ -29,15 +29,20 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 #include "Default.hh"
 
 #include <apn/CfgFileOptions.hpp>
 #include <apn/WebObject.hpp>
-#include <dsh/PointData.hpp>
+#include <apn/InThreadQueue.hpp>
+#include <dsh/PointIndex.hpp>
 
 
 
@@ -47,11 +52,10 @@ public:
 	typedef std::vector<std::string> sVec;
 	typedef std::vector<std::string> AttrT;
 
-	typedef dsh::PointData<DSHN_DEFAULT_COORDT,AttrT,2> PointDataT2d;
-	typedef dsh::PointData<DSHN_DEFAULT_COORDT,AttrT,3> PointDataT3d;
+	typedef dsh::PointIndex<AttrT> IndexT;
 
-	typedef std::map<std::string,PointDataT2d::pointer> sp2Map;
-	typedef std::map<std::string,PointDataT3d::pointer> sp3Map;
+	typedef std::map<std::string,IndexT::pointer> ipMap;
+	typedef std::map<std::string,sfc_options> soMap;
 	typedef boost::shared_ptr<Work> pointer;
 	/**
 	* create : static construction creates new first time
@@ -88,11 +92,35 @@ public:
 	*   Bool status
 	*/
 	bool run(apn::WebObject::pointer W);
+
+	/**
+	* reload: rebuild indexes from their data sources on a background thread, each is
+	* swapped in when built while searches go on with the old one
+	*
+	* @param index
+	*   std::string Index to rebuild, all if empty
+	*
+	* @return
+	*   Bool false if a rebuild is already running
+	*/
+	bool reload(std::string index);
 private:
-	sp2Map pdmap;
-	sp3Map pemap;
+	typedef boost::function<void (sVec)> SinkT;
+	apn::CfgFileOptions& mycfg;
+	ipMap pdmap;
+	ipMap pemap;
 	sVec params2d;
 	sVec params3d;
+	soMap optmap;
+	bool reloadop;
+	bool updateop;
+	unsigned int maxresults;
+	boost::mutex rebuildmutex;
+	bool rebuilding;
+	std::set<std::string> rebuildset;
+	boost::shared_mutex updatemutex;
+	/** last member, so its thread is joined before the indexes go */
+	apn::InThreadQueue::pointer rebuildq;
 	/**
 	* Constructor : private Constructor
 	*
@@ -120,21 +148,207 @@ private:
 	sVec loadparams(apn::CfgFileOptions& MyCFG, bool is3d);
 
 	/**
-	* load: function for loading, this will be passed on
+	* loadopts: function for loading per index sfc options
 	*
-	* @param index
-	*   std::string Index to Load
+	* @param MyCFG
+	*   apn::CfgFileOptions ConfigFile Options
 	*
-	* @param Indata
-	*   sVec input data object for loading
+	* @param section
+	*   std::string config section of the index
+	*
+	* @return
+	*   sfc_options
+	*/
+	sfc_options loadopts(apn::CfgFileOptions& MyCFG, std::string section);
+
+	/**
+	* create: new empty index of a config section, of its coordtype, a geo index if
+	* the section is one
+	*
+	* @param section
+	*   std::string config section of the index
+	*
+	* @param is3d
+	*   bool is it 3d
+	*
+	* @return
+	*   IndexT::pointer
+	*/
+	IndexT::pointer create(std::string section, bool is3d);
+
+	/**
+	* make: new empty index of a coordinate type
+	*
+	* @param opts
+	*   sfc_options index build and search options
+	*
+	* @param popts
+	*   dsh::point_options options of the attributes
 	*
 	* @param is3d
 	*   bool is it 3d
 	*
+	* @param geo
+	*   bool is it a geo index
+	*
+	* @return
+	*   IndexT::pointer
+	*/
+	template<class CoordT>
+	static IndexT::pointer make(const sfc_options& opts, const dsh::point_options& popts, bool is3d, bool geo) {
+		return (is3d) ? IndexT::Create<CoordT,3>(opts, popts, geo) : IndexT::Create<CoordT,2>(opts, popts, geo);
+	}
+
+	/**
+	* source: read the data of a config section, this will be passed on
+	*
+	* @param section
+	*   std::string config section of the index
+	*
+	* @param is3d
+	*   bool is it 3d
+	*
+	* @param sink
+	*   SinkT called with the input data of each point
+	*
 	* @return
 	*   none
 	*/
-	void load(std::string index, sVec Indata, bool is3d);
+	void source(std::string section, bool is3d, SinkT sink);
+
+	/**
+	* rebuild: build indexes afresh and swap them in one after the other, so that
+	* only one extra copy of an index is held at a time, always on the same thread
+	* so that each build reuses the memory freed by the last
+	*
+	* @param j
+	*   apn::InThreadQueue::JobType job with the Index to rebuild, all if empty
+	*
+	* @return
+	*   none
+	*/
+	void rebuild(apn::InThreadQueue::JobType j);
+
+	/**
+	* addto: add the input data of one point to an index
+	*
+	* @param p
+	*   IndexT::pointer index
+	*
+	* @param Indata
+	*   sVec input data object for loading, the coordinates after the gid
+	*
+	* @return
+	*   none
+	*/
+	static void addto(IndexT::pointer p, sVec Indata) {
+		if (Indata.size() <= p->Dim())
+			throw apn::GenericException(DSHN_WORK_PROGNO,"too few fields"," for a point");
+		p->Add(IndexT::cVec(Indata.begin()+1, Indata.begin()+1+p->Dim()), Indata);	// x, y, z
+	}
+
+	/**
+	* current: the version of an index searches should use now
+	*
+	* @param m
+	*   M index map
+	*
+	* @param index
+	*   std::string Index to find, by reference as it names the index in errors
+	*
+	* @return
+	*   M::mapped_type the index, held by the caller till done
+	*/
+	template<class M>
+	static typename M::mapped_type current(M& m, const std::string& index) {
+		typename M::iterator it = m.find(index);
+		if (it == m.end()) throw apn::GenericException(DSHN_WORK_PROGNO,"no index",index.c_str());
+		return boost::atomic_load(&it->second);
+	}
+
+	/**
+	* batch: search many points at once, the dimension is the no of coords per point
+	*
+	* @param index
+	*   std::string Index to search
+	*
+	* @param pts
+	*   std::string points as x,y[,z] separated by ;
+	*
+	* @param no
+	*   unsigned int no of results per point
+	*
+	* @param fmt
+	*   std::string output format
+	*
+	* @param filter
+	*   std::string conditions on the fields of the points, none if empty
+	*
+	* @param level
+	*   long* highest level of the points, none if null
+	*
+	* @param ctype
+	*   std::string content type by address
+	*
+	* @param rstr
+	*   std::string result by address
+	*
+	* @return
+	*   Bool status
+	*/
+	bool batch(std::string index, std::string pts, unsigned int no, std::string fmt, std::string filter, const long* level, std::string& ctype, std::string& rstr);
+
+	/**
+	* where: the conditions of a filter param, as field:value|value separated by ;
+	*
+	* @param filter
+	*   std::string filter param
+	*
+	* @param is3d
+	*   bool is it 3d, the fields are those of the dimension
+	*
+	* @return
+	*   dsh::attr_where
+	*/
+	dsh::attr_where where(std::string filter, bool is3d) const;
+
+	/**
+	* update: insert a point given by its fields, or delete the points at a location
+	*
+	* @param index
+	*   std::string Index to update
+	*
+	* @param op
+	*   std::string add or del
+	*
+	* @param W
+	*   WebObject W with the fields of the point as params
+	*
+	* @param is3d
+	*   bool is it 3d
+	*
+	* @param ctype
+	*   std::string content type by address
+	*
+	* @param rstr
+	*   std::string result by address, the no of points added or deleted
+	*
+	* @return
+	*   Bool status
+	*/
+	bool update(std::string index, std::string op, apn::WebObject::pointer W, bool is3d, std::string& ctype, std::string& rstr);
+
+	/**
+	* GidMatch: matches the attributes of a point by gid, all points if no gid
+	*/
+	struct GidMatch {
+		GidMatch(bool has, std::string gid) : has_(has), gid_(gid) {}
+		bool operator()(const IndexT::RowT& a) const {
+			return !has_ || (!a.empty() && a[0]==gid_);
+		}
+		bool has_;
+		std::string gid_;
+	};
 };
 }
 #endif /* _DSHN_WORK_HPP_ */